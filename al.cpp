@@ -15,10 +15,56 @@
 #include <cstdarg>
 #include <csignal>
 #include <memory>
+#include <algorithm>
+#include <chrono>
+#include <sys/resource.h>
+#include <unistd.h>
 
 using namespace llvm;
 using namespace std;
 
+/**
+ * Front end phase timing (--time-phases 1)
+ * Lexing is interleaved with parsing, so with timing on the input is lexed once more on
+ * its own first and the parse phase reports lexing + parsing. Memory is the resident set
+ * growth during the phase and the peak resident set after it.
+ */
+struct PhaseTimer {
+  bool enabled;
+  size_t nLines;
+  std::chrono::steady_clock::time_point start;
+  long startRssKb;
+
+  static long rssKb() {
+    long pages = 0, resident = 0;
+    ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+  }
+  static long peakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+  }
+
+  void begin() {
+    if (enabled) {
+      startRssKb = rssKb();
+      start = std::chrono::steady_clock::now();
+    }
+  }
+  void end(const char *phase) {
+    if (!enabled) {
+      return;
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    us = std::max<long long>(us, 1);
+    cerr << "phase " << phase << ": " << us << " us, "
+         << (uint64_t)(nLines * 1000000.0 / us) << " lines/s, rss +" << rssKb() - startRssKb
+         << " KB, peak rss " << peakRssKb() << " KB" << endl;
+  }
+};
+
 unique_ptr<al::CompileTime> compile(int argc, char** argv) {
   if (argc < 2) {
     cerr << "wrong arguments" << endl;
@@ -29,21 +75,36 @@ unique_ptr<al::CompileTime> compile(int argc, char** argv) {
   std::string str((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
 
   auto rt = make_unique<al::CompileTime>(argc, argv);
+  PhaseTimer timer = {rt->getConfig().timePhases, (size_t)std::count(str.begin(), str.end(), '\n')};
+
+  if (timer.enabled) {
+    timer.begin();
+    al::Lexer lexOnly(str);
+    while (lexOnly.lex().type_get() != 0);
+    timer.end("lex");
+  }
 
+  timer.begin();
   al::Lexer lexer(str);
   al::Parser parser(lexer, *rt);
   int result = parser.parse();
   if (result != 0) {
     abort();
   }
+  timer.end("parse");
 
   /**
    * AST passes
    */
 
+  timer.begin();
   rt->init1();
-  rt->traverseAll();
+  rt->traversePvarTagging();
+  timer.end("pvar-tagging");
+  timer.begin();
+  rt->traverseCodegen();
   rt->finish1();
+  timer.end("codegen");
 
   return rt;
 }
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Benchmark harness for test/nvm_perf
+ * Every benchmark runs under every variant (a set of compiler flags passed to ali),
+ * first `warmup` times unmeasured, then `runs` times. A run's sample is the sum of the
+ * integers it prints, the nanoseconds the benchmark measured itself with tic/toc,
+ * or its wall time when it prints none.
+ *
+ * usage: albench [--ali path] [--warmup n] [--runs n] [--json file] [--variant name=flags]... file.al...
+ */
+
+struct Variant {
+  string name;
+  string flags;
+};
+
+struct Result {
+  string file;
+  Variant variant;
+  bool selfTimed = false;
+  vector<double> samples;
+  double median = 0, p99 = 0, mean = 0, stddev = 0, min = 0, max = 0;
+};
+
+string shellQuote(const string &s) {
+  string quoted = "'";
+  for (auto c : s) {
+    if (c == '\'') {
+      quoted += "'\\''";
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + "'";
+}
+
+string jsonQuote(const string &s) {
+  string quoted = "\"";
+  for (auto c : s) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+// Runs ali once, returns false if it failed
+bool runOnce(const string &ali, const Variant &variant, const string &file, double &sample, bool &selfTimed) {
+  auto cmd = shellQuote(ali) + " " + variant.flags + " " + shellQuote(file) + " 2>/dev/null";
+  auto start = chrono::steady_clock::now();
+  FILE *out = popen(cmd.c_str(), "r");
+  if (out == nullptr) {
+    return false;
+  }
+  char line[256];
+  double reported = 0;
+  selfTimed = false;
+  while (fgets(line, sizeof(line), out) != nullptr) {
+    char *end;
+    auto value = strtoll(line, &end, 10);
+    if (end != line && (*end == '\n' || *end == '\0')) {
+      reported += (double)value;
+      selfTimed = true;
+    }
+  }
+  auto status = pclose(out);
+  auto wall = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+  sample = selfTimed ? reported : (double)wall;
+  return status == 0;
+}
+
+void computeStats(Result &r) {
+  auto sorted = r.samples;
+  sort(sorted.begin(), sorted.end());
+  auto n = sorted.size();
+  r.min = sorted.front();
+  r.max = sorted.back();
+  r.median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+  // nearest rank
+  r.p99 = sorted[(size_t)ceil(0.99 * n) - 1];
+  double sum = 0;
+  for (auto s : sorted) {
+    sum += s;
+  }
+  r.mean = sum / n;
+  double sq = 0;
+  for (auto s : sorted) {
+    sq += (s - r.mean) * (s - r.mean);
+  }
+  r.stddev = n > 1 ? sqrt(sq / (n - 1)) : 0;
+}
+
+void writeJson(const string &path, const string &ali, int warmup, int runs, const vector<Result> &results) {
+  ofstream out(path);
+  out << "{\n  \"ali\": " << jsonQuote(ali) << ",\n  \"warmup\": " << warmup << ",\n  \"runs\": " << runs
+      << ",\n  \"results\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto &r = results[i];
+    out << (i ? "," : "") << "\n    {\"file\": " << jsonQuote(r.file)
+        << ", \"variant\": " << jsonQuote(r.variant.name)
+        << ", \"flags\": " << jsonQuote(r.variant.flags)
+        << ", \"unit\": " << (r.selfTimed ? "\"reported_ns\"" : "\"wall_ns\"")
+        << ", \"median\": " << r.median << ", \"p99\": " << r.p99
+        << ", \"mean\": " << r.mean << ", \"stddev\": " << r.stddev
+        << ", \"min\": " << r.min << ", \"max\": " << r.max
+        << ", \"samples\": [";
+    for (size_t j = 0; j < r.samples.size(); ++j) {
+      out << (j ? ", " : "") << r.samples[j];
+    }
+    out << "]}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+int main(int argc, char **argv) {
+  string ali = "./ali";
+  string jsonPath;
+  int warmup = 1;
+  int runs = 10;
+  vector<Variant> variants;
+  vector<string> files;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--ali" && hasValue) {
+      ali = argv[++i];
+    } else if (arg == "--warmup" && hasValue) {
+      warmup = atoi(argv[++i]);
+    } else if (arg == "--runs" && hasValue) {
+      runs = max(1, atoi(argv[++i]));
+    } else if (arg == "--json" && hasValue) {
+      jsonPath = argv[++i];
+    } else if (arg == "--variant" && hasValue) {
+      string v = argv[++i];
+      auto eq = v.find('=');
+      if (eq == string::npos) {
+        cerr << "--variant expects name=flags" << endl;
+        return 1;
+      }
+      variants.push_back({v.substr(0, eq), v.substr(eq + 1)});
+    } else {
+      files.push_back(arg);
+    }
+  }
+  if (files.empty()) {
+    cerr << "usage: albench [--ali path] [--warmup n] [--runs n] [--json file] [--variant name=flags]... file.al..." << endl;
+    return 1;
+  }
+  if (variants.empty()) {
+    variants = {
+        {"default", ""},
+        {"flush-all", "--enable-opt-flush-only-nvm 0"},
+        {"no-batch", "--enable-opt-batch 0"},
+    };
+  }
+
+  vector<Result> results;
+  bool failed = false;
+  cout << "file, variant, unit, median, p99, stddev" << endl;
+  for (auto &file : files) {
+    for (auto &variant : variants) {
+      Result r;
+      r.file = file;
+      r.variant = variant;
+      double sample;
+      bool ok = true;
+      for (int i = 0; i < warmup + runs && ok; ++i) {
+        ok = runOnce(ali, variant, file, sample, r.selfTimed);
+        if (i >= warmup) {
+          r.samples.push_back(sample);
+        }
+      }
+      if (!ok) {
+        cerr << file << " failed with " << variant.name << endl;
+        failed = true;
+        continue;
+      }
+      computeStats(r);
+      cout << file << ", " << variant.name << ", " << (r.selfTimed ? "reported ns" : "wall ns")
+           << ", " << r.median << ", " << r.p99 << ", " << r.stddev << endl;
+      results.push_back(r);
+    }
+  }
+  if (!jsonPath.empty()) {
+    writeJson(jsonPath, ali, warmup, runs, results);
+  }
+  return failed ? 1 : 0;
+}
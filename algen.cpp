@@ -0,0 +1,120 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+/**
+ * Generates synthetic .al programs for front end benchmarks, on stdout:
+ * - `--structs n` structs of `--fields n` int32 fields
+ * - a persistent block of `--persistent n` struct vars
+ * - `--functions n` functions, each with `--statements n` statements per block and
+ *   for/if blocks nested `--depth n` deep, storing into the persistent vars and
+ *   calling the previous function
+ *
+ * e.g. algen --functions 1000 --depth 4 > big.al && alc --time-phases 1 big.al
+ */
+
+struct GenOptions {
+  int structs = 10;
+  int fields = 8;
+  int persistent = 10;
+  int functions = 10;
+  int statements = 10;
+  int depth = 3;
+};
+
+string indent(int level) {
+  return string(level * 2, ' ');
+}
+
+void genStatements(const GenOptions &o, int fn, int level, int depth) {
+  for (int s = 0; s < o.statements; ++s) {
+    auto ind = indent(level);
+    switch (s % 4) {
+      case 0:
+        cout << ind << "x = x + " << s << ";\n";
+        break;
+      case 1:
+        cout << ind << "p" << (fn + s) % o.persistent << ".m" << s % o.fields << " = x;\n";
+        break;
+      case 2:
+        if (fn > 0) {
+          cout << ind << "x = f" << fn - 1 << "(x, " << s << ");\n";
+        } else {
+          cout << ind << "x = x << 1;\n";
+        }
+        break;
+      default:
+        cout << ind << "v" << depth << "_" << s << ": int32 = x + p" << s % o.persistent << ".m0;\n";
+        break;
+    }
+  }
+  if (depth >= o.depth) {
+    return;
+  }
+  auto ind = indent(level);
+  if (depth % 2 == 0) {
+    auto i = "i" + to_string(depth);
+    cout << ind << "for " << i << ": int32 = 0; " << i << " < b; " << i << " = " << i << " + 1 {\n";
+    genStatements(o, fn, level + 1, depth + 1);
+    cout << ind << "};\n";
+  } else {
+    cout << ind << "if x < a {\n";
+    genStatements(o, fn, level + 1, depth + 1);
+    cout << ind << "} else {\n";
+    cout << indent(level + 1) << "x = x + 1;\n";
+    cout << ind << "};\n";
+  }
+}
+
+int main(int argc, char **argv) {
+  GenOptions o;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    string arg = argv[i];
+    int value = atoi(argv[i + 1]);
+    if (arg == "--structs") o.structs = value;
+    else if (arg == "--fields") o.fields = value;
+    else if (arg == "--persistent") o.persistent = value;
+    else if (arg == "--functions") o.functions = value;
+    else if (arg == "--statements") o.statements = value;
+    else if (arg == "--depth") o.depth = value;
+    else {
+      cerr << "unknown option " << arg << endl;
+      return 1;
+    }
+  }
+  if (o.structs < 1 || o.fields < 1 || o.persistent < 1 || o.functions < 1) {
+    cerr << "structs, fields, persistent and functions must be at least 1" << endl;
+    return 1;
+  }
+
+  for (int s = 0; s < o.structs; ++s) {
+    cout << "struct S" << s << " {\n";
+    for (int f = 0; f < o.fields; ++f) {
+      cout << "  m" << f << ": int32\n";
+    }
+    cout << "}\n\n";
+  }
+
+  cout << "persistent {\n";
+  for (int p = 0; p < o.persistent; ++p) {
+    cout << "  p" << p << ": S" << p % o.structs << "\n";
+  }
+  cout << "}\n\n";
+
+  cout << "extern {\n  fn putsInt(val: int32);\n}\n\n";
+
+  for (int fn = 0; fn < o.functions; ++fn) {
+    cout << "fn f" << fn << "(a: int32, b: int32) int32 {\n";
+    cout << "  x: int32 = a + b;\n";
+    genStatements(o, fn, 1, 0);
+    cout << "  return (x);\n}\n\n";
+  }
+
+  cout << "fn AL__main() {\n";
+  // f0 is the only function not calling another one, the program is for compiling
+  cout << "  putsInt(f0(1, 2));\n";
+  cout << "}\n";
+  return 0;
+}
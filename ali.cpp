@@ -50,6 +50,7 @@
 #include <zconf.h>
 #include "nvm_malloc/src/nvm_malloc.h"
 #include "al.h"
+#include "jit.h"
 
 using namespace llvm;
 using namespace std;
@@ -72,12 +73,34 @@ int main(int argc, char **argv) {
 
   auto ct = compile(argc, argv);
 
-  LLVMLinkInMCJIT();
   InitializeNativeTarget();
   InitializeNativeTargetAsmPrinter();
+  if (ct->getConfig().enableLazyJit) {
+    // AL__main_end usually exits the process from inside runMain, TierUp stops its
+    // thread in an exit hook. If main returns, the jit is gone before llvm_shutdown
+    {
+      al::Jit jit(ct->getConfig(), ct->getTargetMachine());
+      jit.addModule(ct->moveMainModule());
+      jit.runMain();
+    }
+    llvm_shutdown();
+    return 0;
+  }
+
+  LLVMLinkInMCJIT();
   auto mainFunc = ct->getMainFunc();
   EngineBuilder eb(move(ct->moveMainModule()));
-  auto EE = eb.setEngineKind(EngineKind::JIT).create();
+  auto EE = eb.setEngineKind(EngineKind::JIT).create(al::createJitTargetMachine(ct->getTargetMachine()));
+  std::unique_ptr<al::JitObjectCache> objectCache;
+  if (!ct->getConfig().jitCacheDir.empty()) {
+    objectCache.reset(new al::JitObjectCache(ct->getConfig().jitCacheDir, *EE->getTargetMachine()));
+    EE->setObjectCache(objectCache.get());
+  }
+  std::unique_ptr<al::PerfJitEventListener> perfListener;
+  if (ct->getConfig().enablePerfMap || ct->getConfig().enableJitdump) {
+    perfListener.reset(new al::PerfJitEventListener(ct->getConfig().enablePerfMap, ct->getConfig().enableJitdump));
+    EE->RegisterJITEventListener(perfListener.get());
+  }
   GenericValue gv = EE->runFunction(mainFunc, {});
   delete EE;
   llvm_shutdown();
@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "rt/trace.h"
+
+using namespace std;
+
+/**
+ * Replays a persist trace (AL_NVM_TRACE) cache line by cache line and reports per site:
+ * - redundant flushes: lines flushed again without a store since the last flush
+ * - clean flushes: lines flushed that were never stored to in the trace
+ *   (stores are only recorded with --enable-persist-trace, stores of the runtime never)
+ * - missed coalescing: persists followed by another persist of the same thread without
+ *   a store in between, so both could have shared one fence, and persists whose lines
+ *   overlap or touch the lines of the thread's previous persist
+ */
+
+const uint64_t CacheLineSize = 64;
+
+struct LineState {
+  bool dirty = false;
+  bool flushed = false;
+};
+
+struct ThreadState {
+  bool fenced = false;
+  bool storedSinceFence = false;
+  int32_t lastSite = -1;
+  uint64_t lastFirst = 0;
+  uint64_t lastEnd = 0;
+};
+
+struct SiteReport {
+  uint64_t stores = 0;
+  uint64_t flushes = 0;
+  uint64_t lines = 0;
+  uint64_t redundantLines = 0;
+  uint64_t cleanLines = 0;
+  uint64_t coalescable = 0;
+  uint64_t sameLine = 0;
+
+  uint64_t wasted() const { return redundantLines + cleanLines + coalescable + sameLine; }
+};
+
+struct Site {
+  int32_t line;
+  string function;
+};
+
+bool readString(FILE *f, string &s) {
+  uint32_t len;
+  if (fread(&len, sizeof(len), 1, f) != 1) {
+    return false;
+  }
+  s.resize(len);
+  return len == 0 || fread(&s[0], 1, len, f) == len;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    cerr << "usage: altrace <trace file>" << endl;
+    return 1;
+  }
+  FILE *f = fopen(argv[1], "rb");
+  if (f == nullptr) {
+    cerr << "cannot open " << argv[1] << endl;
+    return 1;
+  }
+
+  AlTraceHeader header;
+  AlTraceTrailer trailer;
+  if (fread(&header, sizeof(header), 1, f) != 1 ||
+      memcmp(header.magic, AlTraceMagic, sizeof(header.magic)) != 0 ||
+      header.version != AlTraceVersion ||
+      header.recordSize != sizeof(AlTraceRecord)) {
+    cerr << argv[1] << " is not a persist trace" << endl;
+    return 1;
+  }
+  if (fseek(f, -(long)sizeof(trailer), SEEK_END) != 0 ||
+      fread(&trailer, sizeof(trailer), 1, f) != 1 ||
+      memcmp(trailer.magic, AlTraceTrailerMagic, sizeof(trailer.magic)) != 0) {
+    cerr << argv[1] << " is truncated, was AL__main_end reached?" << endl;
+    return 1;
+  }
+
+  vector<AlTraceRecord> records((trailer.siteTableOffset - sizeof(header)) / sizeof(AlTraceRecord));
+  fseek(f, sizeof(header), SEEK_SET);
+  if (fread(records.data(), sizeof(AlTraceRecord), records.size(), f) != records.size()) {
+    cerr << "cannot read trace records" << endl;
+    return 1;
+  }
+  vector<Site> sites(trailer.nSites);
+  string sourcePath;
+  for (auto &site : sites) {
+    if (fread(&site.line, sizeof(site.line), 1, f) != 1 || !readString(f, site.function)) {
+      cerr << "cannot read site table" << endl;
+      return 1;
+    }
+  }
+  readString(f, sourcePath);
+  fclose(f);
+
+  // threads are written in chunks, merge them back into one timeline
+  stable_sort(records.begin(), records.end(), [](const AlTraceRecord &a, const AlTraceRecord &b) {
+    return a.timestamp < b.timestamp;
+  });
+
+  unordered_map<uint64_t, LineState> lines;
+  unordered_map<uint16_t, ThreadState> threads;
+  // index nSites is the runtime
+  vector<SiteReport> reports(sites.size() + 1);
+  auto report = [&](int32_t site) -> SiteReport& {
+    return reports[site < 0 || (uint32_t)site >= sites.size() ? sites.size() : (uint32_t)site];
+  };
+  uint64_t nStores = 0;
+
+  for (auto &r : records) {
+    auto first = r.addr / CacheLineSize;
+    auto end = (r.addr + r.size + CacheLineSize - 1) / CacheLineSize;
+    auto &thread = threads[r.thread];
+    switch (r.kind) {
+      case AlTraceStore:
+        nStores++;
+        report(r.site).stores++;
+        for (auto l = first; l < end; ++l) {
+          lines[l].dirty = true;
+        }
+        thread.storedSinceFence = true;
+        break;
+      case AlTraceFlush: {
+        auto &rep = report(r.site);
+        rep.flushes++;
+        rep.lines += end - first;
+        for (auto l = first; l < end; ++l) {
+          auto &state = lines[l];
+          if (!state.dirty) {
+            if (state.flushed) {
+              rep.redundantLines++;
+            } else {
+              rep.cleanLines++;
+            }
+          }
+          state.dirty = false;
+          state.flushed = true;
+        }
+        if (thread.fenced) {
+          if (!thread.storedSinceFence) {
+            report(thread.lastSite).coalescable++;
+          }
+          if (first <= thread.lastEnd && thread.lastFirst <= end) {
+            report(thread.lastSite).sameLine++;
+          }
+        }
+        thread.fenced = false;
+        thread.lastSite = r.site;
+        thread.lastFirst = first;
+        thread.lastEnd = end;
+        break;
+      }
+      case AlTraceFence:
+        thread.fenced = true;
+        thread.storedSinceFence = false;
+        break;
+      default:
+        cerr << "unknown trace record kind " << (int)r.kind << endl;
+        return 1;
+    }
+  }
+
+  vector<uint32_t> order;
+  for (uint32_t i = 0; i < reports.size(); ++i) {
+    if (reports[i].flushes || reports[i].stores) {
+      order.push_back(i);
+    }
+  }
+  sort(order.begin(), order.end(), [&reports](uint32_t a, uint32_t b) {
+    return reports[a].wasted() > reports[b].wasted();
+  });
+
+  cout << records.size() << " records, " << threads.size() << " threads" << endl;
+  if (nStores == 0) {
+    cout << "no stores recorded, compile with --enable-persist-trace 1 to tell clean from dirty lines" << endl;
+  }
+  cout << "site, stores, flushes, flushed lines, redundant lines, clean lines, coalescable fences, same line persists" << endl;
+  for (auto i : order) {
+    if (i == sites.size()) {
+      cout << "  runtime";
+    } else {
+      cout << "  " << sourcePath << ":" << sites[i].line << " " << sites[i].function;
+    }
+    auto &rep = reports[i];
+    cout << ", " << rep.stores << ", " << rep.flushes << ", " << rep.lines
+         << ", " << rep.redundantLines << ", " << rep.cleanLines
+         << ", " << rep.coalescable << ", " << rep.sameLine << endl;
+  }
+  return 0;
+}
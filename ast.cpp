@@ -1,5 +1,6 @@
 #include "ast.h"
 #include <iostream>
+#include <set>
 #include <llvm/Support/raw_ostream.h>
 #include <sstream>
 #include <utility>
@@ -65,7 +66,7 @@ namespace al {
         return true;
       } else if (this->attrs == Type::None) {
         return this->symbol->getName() == rhs.symbol->getName();
-      } else if (this->attrs & Type::Ptr || this->attrs & Type::Persistent){
+      } else if (this->attrs & Type::Ptr || this->attrs & Type::Rc || this->attrs & Type::Persistent){
         return (this->attrs == rhs.attrs) && (this->originalType->same(*rhs.originalType));
       } else {
         cerr << "unreachable code" << endl;
@@ -83,6 +84,8 @@ namespace al {
         return this->symbol->getName();
       } else if (this->attrs & Type::Ptr) {
         return "*" + this->originalType->toString();
+      } else if (this->attrs & Type::Rc) {
+        return "rc<" + this->originalType->toString() + ">";
       } else if (this->attrs & Type::Persistent) {
         return "persistent " + this->originalType->toString();
       } else if (this->attrs & Type::Fn) {
@@ -128,6 +131,13 @@ namespace al {
               this->originalType->getLlvmType(),
               (this->originalType->attrs & Persistent) ? PtrAddressSpace::NVM : PtrAddressSpace::Volatile
           );
+        } else if (this->attrs & Rc) {
+          this->originalType->parseLlvmType(ct);
+          if (!(this->originalType->attrs & Persistent)) {
+            cerr << "rc only supports persistent types '" << this->toString() << "'" << endl;
+            abort();
+          }
+          this->llvmType = llvm::PointerType::get(this->originalType->getLlvmType(), PtrAddressSpace::NVMRc);
         } else if (this->attrs & Array) {
           this->originalType->parseLlvmType(ct);
           this->llvmType = this->getArrayPtrType(this->originalType->getLlvmType());
@@ -296,6 +306,18 @@ namespace al {
       }
 
       Function *fn = nullptr;
+      auto &builder = *ct.getCompilerContext().builder;
+      // binary operators, calls convert their arguments to the parameter types below
+      static const std::set<std::string> binaryOperators = {"+", "-", "%", "<", ">=", "!=", "==", "<<"};
+      if (binaryOperators.count(this->name) && args.size() == 2 &&
+          args[0]->getType()->isIntegerTy() && args[1]->getType()->isIntegerTy() &&
+          args[0]->getType() != args[1]->getType()) {
+        // Operands of different widths are widened to the wider one, e.g. int64 + int32 literal
+        auto wider = args[0]->getType()->getIntegerBitWidth() > args[1]->getType()->getIntegerBitWidth() ?
+                     args[0]->getType() : args[1]->getType();
+        args[0] = builder.CreateSExt(args[0], wider);
+        args[1] = builder.CreateSExt(args[1], wider);
+      }
       if (this->name == "+") {
         if (args.size() != 2) { cerr << "'+' only accepts 2 args" << endl; abort(); }
         vr.value = ct.getCompilerContext().builder->CreateBinOp(
@@ -304,6 +326,14 @@ namespace al {
             args[1]
         );
       }
+      else if (this->name == "-") {
+        if (args.size() != 2) { cerr << "'-' only accepts 2 args" << endl; abort(); }
+        vr.value = builder.CreateSub(args[0], args[1]);
+      }
+      else if (this->name == "%") {
+        if (args.size() != 2) { cerr << "'%' only accepts 2 args" << endl; abort(); }
+        vr.value = builder.CreateSRem(args[0], args[1]);
+      }
       else if (this->name == "<") {
         if (args.size() != 2) { cerr << "'<' only accepts 2 args" << endl; abort(); }
         vr.value = ct.getCompilerContext().builder->CreateZExt(
@@ -322,8 +352,8 @@ namespace al {
             llvm::IntegerType::getInt32Ty(ct.getContext())
         );
       }
-      else if (this->name == "!=") {
-        if (args.size() != 2) { cerr << "'<' only accepts 2 args" << endl; abort(); }
+      else if (this->name == "!=" || this->name == "==") {
+        if (args.size() != 2) { cerr << "'" << this->name << "' only accepts 2 args" << endl; abort(); }
 
         llvm::Value *lhsInt = args[0], *rhsInt = args[1];
         if (args[0]->getType()->isPointerTy()) {
@@ -338,22 +368,21 @@ namespace al {
               llvm::Type::getInt64Ty(ct.getContext())
           );
         }
+        llvm::Value *isEqual = ct.getCompilerContext().builder->CreateICmp(
+            llvm::CmpInst::Predicate::ICMP_EQ,
+            lhsInt,
+            rhsInt
+        );
         vr.value = ct.getCompilerContext().builder->CreateZExt(
-            ct.getCompilerContext().builder->CreateNot(
-                ct.getCompilerContext().builder->CreateICmp(
-                    llvm::CmpInst::Predicate::ICMP_EQ,
-                    lhsInt,
-                    rhsInt
-                )
-            ),
+            this->name == "==" ? isEqual : ct.getCompilerContext().builder->CreateNot(isEqual),
             llvm::IntegerType::getInt32Ty(ct.getContext())
         );
       }
       else if (this->name == "<<") {
         if (args.size() != 2) { cerr << "'<' only accepts 2 args" << endl; abort(); }
-        vr.value = ct.getCompilerContext().builder->CreateZExt(
+        vr.value = ct.getCompilerContext().builder->CreateZExtOrTrunc(
             ct.getCompilerContext().builder->CreateShl(args[0], args[1]),
-            llvm::IntegerType::getInt32Ty(ct.getContext())
+            args[0]->getType()->isIntegerTy(64) ? args[0]->getType() : llvm::IntegerType::getInt32Ty(ct.getContext())
         );
       }
       else {
@@ -362,6 +391,27 @@ namespace al {
           cerr << "Function not found '" << this->name << "'" << endl;
           abort();
         }
+        for (size_t i = 0; i < args.size() && i < fn->getFunctionType()->getNumParams(); ++i) {
+          auto paramType = fn->getFunctionType()->getParamType(i);
+          if (paramType->isIntegerTy() && args[i]->getType()->isIntegerTy() && args[i]->getType() != paramType) {
+            args[i] = ct.createIntConversion(args[i], paramType);
+          }
+        }
+        // runtime out-parameters are written absolute, only nvCompact stores relative pointers
+        static const std::set<std::string> relativeAwareExterns = {"nvCompact"};
+        if (ct.getConfig().enableRelativeNvmPtr && fn->isDeclaration() && !relativeAwareExterns.count(this->name)) {
+          for (size_t i = 0; i < args.size(); ++i) {
+            auto type = args[i]->getType();
+            if (dynamic_pointer_cast<ExpGetAddr>(exps[i]) && type->isPointerTy() &&
+                isNvmAddressSpace(type->getPointerAddressSpace()) &&
+                CompileTime::containsNvmPtr(type->getPointerElementType())) {
+              cerr << "'" << this->name << "' cannot write argument " << i + 1
+                   << " under --enable-relative-nvm-ptr, it is persistent and holds NVM pointers. "
+                   << "Pass the address of a volatile local and assign that" << endl;
+              abort();
+            }
+          }
+        }
         vr.value = ct.getCompilerContext().builder->CreateCall(fn, args);
       }
     }
@@ -392,22 +442,46 @@ namespace al {
 
       CompilerContext cc(ct.getContext(), fn, BasicBlock::Create(ct.getContext(), "entry", fn), nullptr);
       ct.pushContext(cc);
+      ct.createDebugFunction(fn, getLine());
 
+      if (CompileTime::containsRcType(fn->getReturnType())) {
+        cerr << "Functions cannot return rc values '" << this->getName() << "'" << endl;
+        abort();
+      }
+
+      ct.clearRcArgs();
+      // all argument slots first, the shadow stack frame goes after the roots among them
+      std::vector<llvm::Value*> argSlots;
+      for (auto argType : argTypes) {
+        argSlots.push_back(ct.createEntryAlloca(argType));
+      }
       int i = 0;
       for (auto &arg : fn->args()) {
-        auto varNewLocation = ct.getCompilerContext().builder->CreateAlloca(argTypes[i]);
+        auto varNewLocation = argSlots[i];
+        if (ct.isGcRootType(argTypes[i])) {
+          ct.registerGcRoot(varNewLocation);
+        }
+        if (CompileTime::isRcType(argTypes[i])) {
+          // the callee holds its own reference, released on return
+          ct.createRcInc(&arg);
+          ct.registerRcArg(varNewLocation);
+        }
         ct.getCompilerContext().builder->CreateStore(&arg, varNewLocation);
         ct.setFunctionStackVariable(fn->getName(), argNames[i], varNewLocation);
         i++;
       }
+      ct.createProfileEntry(fn);
 
       for (auto &child : this->getChildren()) {
         child->visit(ct);
       }
 
-      if (fn->getReturnType()->isVoidTy()) {
+      if (fn->getReturnType()->isVoidTy() &&
+          ct.getCompilerContext().builder->GetInsertBlock()->getTerminator() == nullptr) {
+        ct.createReturnUnwind();
         ct.getCompilerContext().builder->CreateRetVoid();
       }
+      ct.createGcRootFrame();
 //      if (!verifyFunction(*ct.getCompilerContext().function)) {
 //        cout << "failed to verifyFunction " << ct.getCompilerContext().function->getName().str() << endl;
 //      }
@@ -455,7 +529,7 @@ namespace al {
             type->getLlvmType()->isPointerTy()) {
           // FIXME: support global volatile variables
           vr.gepResult = ct.createGetMemNvmVar(varName);
-          vr.value = ct.getCompilerContext().builder->CreateLoad(vr.gepResult);
+          vr.value = ct.createLoad(vr.gepResult);
         }
         else {
           cerr << "persistent var type not supported '" << varName << "'" << endl;
@@ -562,7 +636,7 @@ namespace al {
               elementPtr,
               llvm::PointerType::get(elementType, lhsPtr->getType()->getPointerAddressSpace())
           );
-          vr.value = ct.getCompilerContext().builder->CreateLoad(vr.gepResult);
+          vr.value = ct.createLoad(vr.gepResult);
         }
         else {
           cerr << "memberAccess element type not supported " << structAstType->getMembers()[idx] << endl;
@@ -597,6 +671,7 @@ namespace al {
       }
       reinterpret_cast<StructType*>(this->type->getLlvmType())->setBody(elements);
       this->type->setMemberNames(elementNames);
+      ct.registerTypeDescriptor(reinterpret_cast<StructType*>(this->type->getLlvmType()));
     }
 
     FnDecl::FnDecl(sp<Symbol> name, sp<Type> ret, sp<VarDecls> args) :name(move(name)), ret(ret), args(move(args)) {
@@ -660,6 +735,7 @@ namespace al {
     }
 
     void ExpAssign::postVisit(CompileTime &ct) {
+      ct.setCurrentLine(getLine());
       auto exps = getChildren();
       if (exps.size() != 2) { cerr << "'=' only accepts 2 args" << endl; abort(); }
 
@@ -731,7 +807,7 @@ namespace al {
       auto ptr = getChildren()[0]->getVR().value;
       if (ptr->getType()->isPointerTy()) {
         vr.gepResult = ptr;
-        vr.value = ct.getCompilerContext().builder->CreateLoad(ptr);
+        vr.value = ct.createLoad(ptr);
       }
       else {
         cerr << "not a pointer " << ptr->getName().str() << endl;
@@ -741,8 +817,8 @@ namespace al {
     }
 
     void ExpStackVarDef::postVisit(CompileTime &ct) {
+      ct.setCurrentLine(getLine());
       auto expVr = this->exp->getVR();
-      auto &cc = ct.getCompilerContext();
       auto type = this->decl->getType();
       auto llvmType = type->getLlvmType();
       llvm::Value *var;
@@ -756,9 +832,7 @@ namespace al {
       } else {
         // TODO: generalize array definition
         if (type->getAttrs() & Type::Array) {
-          var = type->createArrayByAlloca(
-              *ct.getMainModule(),
-              *ct.getCompilerContext().builder,
+          var = ct.createScopedArray(
               reinterpret_cast<llvm::PointerType*>(type->getLlvmType()),
               type->getArraySizeVal()
           );
@@ -770,7 +844,7 @@ namespace al {
               Type::ptrToElementCountOfArray(*ct.getCompilerContext().builder, var)
           );
         } else {
-          var = cc.builder->CreateAlloca(llvmType);
+          var = ct.createScopedAlloca(llvmType);
         }
         ct.setFunctionStackVariable(
             ct.getCompilerContext().function->getName(),
@@ -822,14 +896,12 @@ namespace al {
 
     VisitResult ExpFor::visit(CompileTime &ct) {
       auto outerAnnotation = ct.getCompilerContext().annotation;
-      if (this->annotation && this->annotation->getName() == "batch") {
+      ct.pushLoopScope();
+      if (this->annotation && this->annotation->getName() == "batch" && ct.getConfig().enableOptBatch) {
 
-        auto batchCount = this->annotation->getBatchCount();
         // init expression
         this->initExp->visit(ct);
-        auto counterVal = ct.getCompilerContext().builder->CreateAlloca(
-            llvm::IntegerType::getInt32Ty(ct.getContext())
-        );
+        auto counterVal = ct.createEntryAlloca(llvm::IntegerType::getInt32Ty(ct.getContext()));
         ct.getCompilerContext().builder->CreateStore(
             llvm::ConstantInt::get(llvm::IntegerType::get(ct.getContext(), 32), 0),
             counterVal
@@ -853,11 +925,9 @@ namespace al {
             judgeResult.value,
             llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(ct.getContext()), 0, true)
         );
-        ct.getCompilerContext().builder->CreateCondBr(
-            isFalse,
-            doneBlock,
-            bodyBlock
-        );
+        auto loopCounts = ct.createProfiledCondBr(isFalse, doneBlock, bodyBlock);
+        ct.setCurrentLine(getLine());
+        auto batchCount = ct.getBatchCount(this->annotation->getBatchCount(), loopCounts);
 
         CompilerContext bodyCt(ct.getContext(), function, bodyBlock, doneBlock, this->annotation);
         ct.popContext();
@@ -901,6 +971,7 @@ namespace al {
         ct.popContext();
         ct.pushContext(nextCt);
 
+        ct.popLoopScope();
         return this->vr;
 
       } else {
@@ -925,11 +996,7 @@ namespace al {
             judgeResult.value,
             llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(ct.getContext()), 0, true)
         );
-        ct.getCompilerContext().builder->CreateCondBr(
-            isFalse,
-            doneBlock,
-            bodyBlock
-        );
+        ct.createProfiledCondBr(isFalse, doneBlock, bodyBlock);
 
         CompilerContext bodyCt(ct.getContext(), function, bodyBlock, doneBlock, outerAnnotation);
         ct.popContext();
@@ -942,10 +1009,11 @@ namespace al {
         llvm::IRBuilder<> doneBlockBuilder(doneBlock);
         doneBlockBuilder.CreateBr(nextBlock);
 
-        CompilerContext nextCt(ct.getContext(), function, nextBlock, nullptr, this->annotation);
+        CompilerContext nextCt(ct.getContext(), function, nextBlock, nullptr, outerAnnotation);
         ct.popContext();
         ct.pushContext(nextCt);
 
+        ct.popLoopScope();
         return this->vr;
       }
     }
@@ -978,11 +1046,7 @@ namespace al {
           vr.value,
           llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(ct.getContext()), 0, true)
       );
-      ct.getCompilerContext().builder->CreateCondBr(
-          isFalse,
-          falseBlock,
-          trueBlock
-      );
+      ct.createProfiledCondBr(isFalse, falseBlock, trueBlock);
 
       CompilerContext trueCt(ct.getContext(), function, trueBlock, breakToBlock, outerAnnotation);
       ct.popContext();
@@ -1004,6 +1068,28 @@ namespace al {
       return this->vr;
     }
 
+    VisitResult Stmts::visit(CompileTime &ct) {
+      for (auto &stmt : getChildren()) {
+        ct.setDebugLine(stmt->getLine());
+        vr = stmt->visit(ct);
+      }
+      return vr;
+    }
+
+    VisitResult StmtBlock::visit(CompileTime &ct) {
+      ct.pushStackScope();
+      auto ret = ASTNode::visit(ct);
+      ct.popStackScope();
+      return ret;
+    }
+
+    VisitResult ExpRegion::visit(CompileTime &ct) {
+      ct.createRegionEnter();
+      this->body->visit(ct);
+      ct.createRegionLeave();
+      return this->vr;
+    }
+
     int Annotation::getBatchCount() {
 //      if (!this->isBatchFor(nvmVarName))
 //        return -1;
@@ -1030,7 +1116,10 @@ namespace al {
           this->lhs->getVarRefType() == ExpVarRef::VarRefType::StackVolatile) {
         auto fnName = ct.getCompilerContext().function->getName();
         auto rhsVar = ct.getFunctionStackVariable(ct.getCompilerContext().function->getName(), this->rhs->getName());
-        ct.setFunctionStackVariable(fnName, this->lhs->getName(), rhsVar);
+        // rhs storage now lives as long as lhs, which may be declared in an outer scope
+        if (ct.moveScopedAlloca(rhsVar, ct.getFunctionStackVariable(fnName, this->lhs->getName()))) {
+          ct.setFunctionStackVariable(fnName, this->lhs->getName(), rhsVar);
+        }
         ct.unsetFunctionStackVariable(fnName, this->rhs->getName());
       }
     }
@@ -1052,9 +1141,7 @@ namespace al {
       this->type->visit(ct);
 
       auto arrayElementPtrType = reinterpret_cast<llvm::PointerType*>(this->type->getLlvmType());
-      auto arr = Type::createArrayByAlloca(
-          *ct.getMainModule(),
-          *ct.getCompilerContext().builder,
+      auto arr = ct.createScopedArray(
           arrayElementPtrType,
           this->type->getArraySizeVal()
       );
@@ -1081,7 +1168,7 @@ namespace al {
     void ExpArrayIndex::postVisit(CompileTime &ct) {
       auto elementPtr = Type::getArrayElementPtr(*ct.getCompilerContext().builder, arr->getVR().gepResult, this->index->getVR().value);
       this->vr.gepResult = elementPtr;
-      this->vr.value = ct.getCompilerContext().builder->CreateLoad(elementPtr);
+      this->vr.value = ct.createLoad(elementPtr);
     }
 
     void ExpSizeOf::postVisit(CompileTime &ct) {
@@ -1089,7 +1176,21 @@ namespace al {
       vr.value = llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(ct.getContext()), this->size);
     }
 
+    void ExpTypeId::postVisit(CompileTime &ct) {
+      auto llvmType = type->getLlvmType();
+      if (!llvmType->isStructTy()) {
+        cerr << "typeid only supports struct types '" << type->toString() << "'" << endl;
+        abort();
+      }
+      vr.value = llvm::ConstantInt::get(
+          llvm::IntegerType::getInt32Ty(ct.getContext()),
+          (uint64_t)ct.getTypeDescriptorId(reinterpret_cast<llvm::StructType*>(llvmType))
+      );
+    }
+
     void ExpReturn::postVisit(CompileTime &ct) {
+      // All regions, scopes and rc arguments of this function die with it
+      ct.createReturnUnwind();
       // FIXME: llvm only support return at the end of a function
       if (exp) {
         ct.getCompilerContext().builder->CreateRet(exp->getVR().value);
@@ -1105,6 +1206,7 @@ namespace al {
         abort();
       }
 
+      ct.createLoopUnwind();
       auto invalidBlock = BasicBlock::Create(ct.getContext(), "break_useless", ct.getCompilerContext().function);
 
       ct.getCompilerContext().builder->CreateCondBr(
@@ -71,8 +71,12 @@ namespace al {
         this->children.insert(this->children.begin(), node);
       }
       VisitResult getVR() const { return vr; }
+      // source line, 0 if unknown
+      unsigned getLine() const { return line; }
+      void setLine(unsigned line) { this->line = line; }
     protected:
       VisitResult vr;
+      unsigned line = 0;
 
       static int indent;
       static void incIndent() { indent++; }
@@ -149,7 +153,7 @@ namespace al {
     };
     class Type :public ASTNode {
     public:
-      enum { None = 1, Ptr = 2, Persistent = 4, Fn = 8, Array = 16 };
+      enum { None = 1, Ptr = 2, Persistent = 4, Fn = 8, Array = 16, Rc = 32 };
 
       /**
        * Create a symbol ref pre-defined type
@@ -166,7 +170,7 @@ namespace al {
       static sp<Type> getInt32Type(llvm::LLVMContext &context);
 
       /**
-       * Create a pointer or persistent type
+       * Create a pointer, rc or persistent type
        * @param originalType
        * @param attrs
        */
@@ -242,12 +246,15 @@ namespace al {
 //      VisitResult visit(CompileTime &ct) override;
     };
     class Stmts :public ASTNode {
+    public:
+      VisitResult visit(CompileTime &ct) override;
     };
     class StmtBlock :public ASTNode {
     public:
       explicit StmtBlock(const std::shared_ptr<Stmts> &stmts = std::make_shared<Stmts>()) {
         appendChild(stmts);
       }
+      VisitResult visit(CompileTime &ct) override;
     };
 
     class FnDef :public Block {
@@ -425,6 +432,14 @@ namespace al {
       sp<StmtBlock> falseBranch;
     };
 
+    class ExpRegion :public Exp {
+    public:
+      explicit ExpRegion(sp<StmtBlock> body) :body(body) { appendChild(body); }
+      VisitResult visit(CompileTime &ct) override;
+    private:
+      sp<StmtBlock> body;
+    };
+
     class Symbol :public Exp {
     public:
       explicit Symbol(std::string s): s(std::move(s)) { }
@@ -474,6 +489,13 @@ namespace al {
       sp<Type> type;
       uint64_t size;
     };
+    class ExpTypeId :public Literal {
+    public:
+      explicit ExpTypeId(const sp<Type> &type) :type(type) { appendChildIfNotNull(type); }
+      void postVisit(CompileTime &ct) override;
+    private:
+      sp<Type> type;
+    };
     class ArrayLiteral :public Literal {
     public:
       explicit ArrayLiteral(sp<ExpList> exps) :exps(exps) {
@@ -5,15 +5,29 @@
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/ProfileSummary.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
 #include <algorithm>
+#include <functional>
 #include <map>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -27,7 +41,15 @@ using namespace llvm;
 using namespace std;
 
 void al::CompileTime::traverseAll() {
+  traversePvarTagging();
+  traverseCodegen();
+}
+
+void al::CompileTime::traversePvarTagging() {
   this->root->traverse(*this, *this->pvarTag);
+}
+
+void al::CompileTime::traverseCodegen() {
   this->root->visit(*this);
 }
 
@@ -35,6 +57,92 @@ void al::CompileTime::traverseAll() {
 void al::CompileTime::setupMainModule() {
   mainModule = llvm::make_unique<llvm::Module>("main", theContext);
 
+  InitializeNativeTarget();
+  Triple triple(sys::getProcessTriple());
+  std::string error;
+  // --march only picks among the arches of the native target, e.g. x86 on x86-64
+  auto target = TargetRegistry::lookupTarget(config.march, triple, error);
+  if (target == nullptr) {
+    cerr << "cannot find target " << (config.march.empty() ? triple.str() : config.march) << ": " << error << endl;
+    abort();
+  }
+  std::string cpu = config.mcpu;
+  SubtargetFeatures features;
+  if (cpu.empty() && config.march.empty()) {
+    // the host's own CPU with the features it actually has, e.g. avx512f or clwb
+    cpu = sys::getHostCPUName();
+    StringMap<bool> hostFeatures;
+    if (sys::getHostCPUFeatures(hostFeatures)) {
+      for (auto &feature : hostFeatures) {
+        features.AddFeature(feature.first(), feature.second);
+      }
+    }
+  } else if (cpu.empty()) {
+    cpu = "generic";
+  }
+  targetMachine.reset(target->createTargetMachine(
+      triple.str(), cpu, features.getString(), TargetOptions(), Optional<Reloc::Model>()
+  ));
+  if (targetMachine == nullptr) {
+    cerr << "cannot create target machine for " << triple.str() << " " << cpu << endl;
+    abort();
+  }
+  mainModule->setTargetTriple(triple.str());
+  mainModule->setDataLayout(targetMachine->createDataLayout());
+
+  if (config.enableDebugInfo) {
+    debugBuilder = llvm::make_unique<DIBuilder>(*mainModule);
+    SmallString<128> path(config.sourcePath);
+    sys::fs::make_absolute(path);
+    debugFile = debugBuilder->createFile(sys::path::filename(path), sys::path::parent_path(path));
+    debugBuilder->createCompileUnit(dwarf::DW_LANG_C, debugFile, "alc", false, "", 0);
+    mainModule->addModuleFlag(Module::Warning, "Debug Info Version", DEBUG_METADATA_VERSION);
+    mainModule->addModuleFlag(Module::Warning, "Dwarf Version", 4);
+  }
+}
+
+void al::CompileTime::createDebugFunction(llvm::Function *fn, unsigned line) {
+  if (debugBuilder == nullptr) {
+    return;
+  }
+  auto sp = debugBuilder->createFunction(
+      debugFile, fn->getName(), fn->getName(), debugFile, line,
+      debugBuilder->createSubroutineType(debugBuilder->getOrCreateTypeArray({})),
+      false, true, line
+  );
+  fn->setSubprogram(sp);
+  getCompilerContext().builder->SetCurrentDebugLocation(DebugLoc::get(line, 0, sp));
+}
+
+void al::CompileTime::setDebugLine(unsigned line) {
+  if (debugBuilder == nullptr || line == 0) {
+    return;
+  }
+  auto sp = getCompilerContext().function->getSubprogram();
+  if (sp != nullptr) {
+    getCompilerContext().builder->SetCurrentDebugLocation(DebugLoc::get(line, 0, sp));
+  }
+}
+
+void al::CompileTime::finalizeDebugInfo() {
+  // calls between functions with debug info need a location, the verifier rejects them otherwise
+  for (auto &f : *mainModule) {
+    auto sp = f.getSubprogram();
+    if (sp == nullptr) {
+      continue;
+    }
+    DebugLoc last = DebugLoc::get(sp->getLine(), 0, sp);
+    for (auto &bb : f) {
+      for (auto &inst : bb) {
+        if (inst.getDebugLoc()) {
+          last = inst.getDebugLoc();
+        } else {
+          inst.setDebugLoc(last);
+        }
+      }
+    }
+  }
+  debugBuilder->finalize();
 }
 
 al::CompileTime::CompileTime(int argc, char **argv)
@@ -47,6 +155,9 @@ llvm::Module* al::CompileTime::getMainModule() const { return mainModule.get();
 
 void al::CompileTime::init1() {
   setupMainModule();
+  if (!config.profileUse.empty()) {
+    loadProfile();
+  }
   registerBuiltinTypes();
   createMainFunc();
 }
@@ -105,7 +216,7 @@ void al::CompileTime::createMainFunc() {
       ),
       Function::LinkageTypes::ExternalLinkage, "AL__main", getMainModule()
   );
-  builder.CreateCall(userFn, {});
+  userMainCall = builder.CreateCall(userFn, {});
   auto alMainEnd = Function::Create(
       FunctionType::get(
           Type::getVoidTy(theContext),
@@ -123,6 +234,179 @@ al::CompileTime::~CompileTime() {
 }
 
 void al::CompileTime::finish1() {
+  createTypeDescriptors();
+  if (debugBuilder != nullptr) {
+    finalizeDebugInfo();
+  }
+  if (this->config.enablePersistStats || this->config.enablePersistTrace) {
+    createPersistSites();
+  }
+  if (this->config.enablePersistStats) {
+    createMainPrologueCall("alEnablePersistStats", FunctionType::get(Type::getVoidTy(theContext), {}, false), {});
+  }
+  if (!this->config.profileGenerate.empty()) {
+    createProfileCounters();
+  }
+  if (!this->config.profileUse.empty()) {
+    createProfileSummary();
+  }
+  if (this->config.enableRelativeNvmPtr) {
+    // tells runtime functions reading pointers out of NVM objects
+    createMainPrologueCall(
+        "alSetRelativeNvmPtr",
+        FunctionType::get(Type::getVoidTy(theContext), {Type::getInt32Ty(theContext)}, false),
+        {ConstantInt::get(Type::getInt32Ty(theContext), 1)}
+    );
+  }
+  // the runtime collects only when asked to by AL_GC_TRIGGER_MB or gcCollect
+  createMainPrologueCall(
+      "alGcSetup",
+      FunctionType::get(Type::getVoidTy(theContext), {Type::getInt32Ty(theContext), Type::getInt32Ty(theContext)}, false),
+      {
+          ConstantInt::get(Type::getInt32Ty(theContext), this->config.enableGcShadowStack ? 1 : 0),
+          ConstantInt::get(Type::getInt32Ty(theContext), this->config.enableGcWriteBarrier ? 1 : 0)
+      }
+  );
+  // after the descriptors and the pointer mode are registered, nvCompact reads both
+  if (!this->config.nvmCompact.empty()) {
+    createOfflineCompaction();
+  }
+}
+
+void al::CompileTime::createOfflineCompaction() {
+  IRBuilder<> builder(userMainCall);
+  auto i8PtrType = PointerType::get(Type::getInt8Ty(theContext), 0);
+  auto getNvmVar = getMainModule()->getOrInsertFunction(
+      "getNvmVar",
+      FunctionType::get(i8PtrType, {Type::getInt32Ty(theContext), Type::getInt64Ty(theContext)}, false)
+  );
+  auto nvCompact = getMainModule()->getOrInsertFunction(
+      "nvCompact",
+      FunctionType::get(
+          Type::getVoidTy(theContext),
+          {PointerType::get(i8PtrType, 0), Type::getInt32Ty(theContext)},
+          false
+      )
+  );
+
+  std::stringstream ss(this->config.nvmCompact);
+  std::string name;
+  while (std::getline(ss, name, ',')) {
+    auto t = hasSymbol(name) ? getSymbolType(name)->getLlvmType() : nullptr;
+    if (t == nullptr || !t->isPointerTy() || isRcType(t) || !t->getPointerElementType()->isStructTy()) {
+      cerr << "--nvm-compact: '" << name << "' is not a persistent struct pointer" << endl;
+      abort();
+    }
+    getTypeDescriptorId(static_cast<llvm::StructType*>(t->getPointerElementType()));
+
+    int varId = getNvmVarId(name);
+    auto slot = builder.CreateCall(getNvmVar, {
+        ConstantInt::get(Type::getInt32Ty(theContext), (uint64_t)varId),
+        ConstantInt::get(Type::getInt64Ty(theContext), 8)
+    });
+    builder.CreateCall(nvCompact, {
+        builder.CreatePointerCast(slot, PointerType::get(i8PtrType, 0)),
+        ConstantInt::get(Type::getInt32Ty(theContext), (uint64_t)this->config.nvmCompactOrder)
+    });
+  }
+}
+
+void al::CompileTime::createMainPrologueCall(const std::string &name, llvm::FunctionType *fnType, llvm::ArrayRef<llvm::Value*> args) {
+  IRBuilder<> builder(userMainCall);
+  builder.CreateCall(getMainModule()->getOrInsertFunction(name, fnType), args);
+}
+
+void al::CompileTime::registerTypeDescriptor(llvm::StructType *type) {
+  this->typeDescriptorTypes.push_back(type);
+}
+
+int al::CompileTime::getTypeDescriptorId(llvm::StructType *type) const {
+  for (size_t i = 0; i < this->typeDescriptorTypes.size(); ++i) {
+    if (this->typeDescriptorTypes[i] == type) {
+      return (int)i;
+    }
+  }
+  cerr << "no type descriptor for '" << type->getName().str() << "'" << endl;
+  abort();
+}
+
+void al::CompileTime::setPointerBits(std::vector<uint64_t> &bitmap, llvm::Type *type, uint64_t offset, bool rcOnly) const {
+  if (type->isPointerTy() && (!rcOnly || isRcType(type))) {
+    auto word = offset / 8;
+    bitmap[word / 64] |= 1ULL << (word % 64);
+  } else if (type->isStructTy()) {
+    auto layout = getMainModule()->getDataLayout().getStructLayout(reinterpret_cast<StructType*>(type));
+    for (unsigned i = 0; i < type->getStructNumElements(); ++i) {
+      setPointerBits(bitmap, type->getStructElementType(i), offset + layout->getElementOffset(i), rcOnly);
+    }
+  } else if (type->isArrayTy()) {
+    auto elementType = type->getArrayElementType();
+    auto elementSize = getMainModule()->getDataLayout().getTypeAllocSize(elementType);
+    for (uint64_t i = 0; i < type->getArrayNumElements(); ++i) {
+      setPointerBits(bitmap, elementType, offset + i * elementSize, rcOnly);
+    }
+  }
+}
+
+void al::CompileTime::createTypeDescriptors() {
+  /**
+   * struct AlTypeDescriptor {
+   *   uint64_t size;
+   *   const uint64_t *pointerBitmap;
+   *   const uint64_t *rcBitmap;
+   * } al_type_descriptors[];
+   */
+  auto i64Type = Type::getInt64Ty(theContext);
+  auto descType = StructType::get(theContext, {i64Type, PointerType::get(i64Type, 0), PointerType::get(i64Type, 0)}, false);
+  std::vector<Constant*> descs;
+  for (auto type : this->typeDescriptorTypes) {
+    auto size = getMainModule()->getDataLayout().getTypeAllocSize(type);
+    auto nWords = (size + 7) / 8;
+
+    std::vector<Constant*> bitmapVars;
+    for (bool rcOnly : {false, true}) {
+      std::vector<uint64_t> bitmap(std::max<uint64_t>((nWords + 63) / 64, 1), 0);
+      setPointerBits(bitmap, type, 0, rcOnly);
+
+      auto bitmapType = ArrayType::get(i64Type, bitmap.size());
+      std::vector<Constant*> words;
+      for (auto word : bitmap) {
+        words.push_back(ConstantInt::get(i64Type, word));
+      }
+      auto bitmapVar = new GlobalVariable(
+          *getMainModule(),
+          bitmapType,
+          true,
+          GlobalValue::PrivateLinkage,
+          ConstantArray::get(bitmapType, words),
+          (rcOnly ? "al_rcmap_" : "al_ptrmap_") + type->getName().str()
+      );
+      bitmapVars.push_back(ConstantExpr::getPointerCast(bitmapVar, PointerType::get(i64Type, 0)));
+    }
+    descs.push_back(ConstantStruct::get(descType, {
+        ConstantInt::get(i64Type, size),
+        bitmapVars[0],
+        bitmapVars[1]
+    }));
+  }
+
+  auto descsType = ArrayType::get(descType, descs.size());
+  auto descsVar = new GlobalVariable(
+      *getMainModule(),
+      descsType,
+      true,
+      GlobalValue::PrivateLinkage,
+      ConstantArray::get(descsType, descs),
+      "al_type_descriptors"
+  );
+  createMainPrologueCall(
+      "alRegisterTypeDescriptors",
+      FunctionType::get(Type::getVoidTy(theContext), {PointerType::get(descType, 0), Type::getInt32Ty(theContext)}, false),
+      {
+          ConstantExpr::getPointerCast(descsVar, PointerType::get(descType, 0)),
+          ConstantInt::get(Type::getInt32Ty(theContext), descs.size())
+      }
+  );
 }
 
 llvm::Value *al::CompileTime::createGetIntNvmVar(const std::string &name) {
@@ -131,7 +415,7 @@ llvm::Value *al::CompileTime::createGetIntNvmVar(const std::string &name) {
     abort();
   }
 
-  int varId = name[name.size() - 1] - '0';
+  int varId = getNvmVarId(name);
 
   auto fn = getMainModule()->getOrInsertFunction(
       "getIntNvmVar",
@@ -147,7 +431,7 @@ void al::CompileTime::createSetPersistentVar(const std::string &name, llvm::Valu
     cerr << "Persistent var not found '" << name << "'" << endl;
     abort();
   }
-  int varId = name[name.size() - 1] - '0';
+  int varId = getNvmVarId(name);
   auto objType = this->getSymbolType(name);
   if (objType->getLlvmType()->isIntegerTy(32)) {
     auto fn = getMainModule()->getOrInsertFunction(
@@ -168,6 +452,7 @@ void al::CompileTime::registerBuiltinTypes() {
 
   std::vector<std::pair<std::string, llvm::Type*>> types = {
       {"int32", llvm::Type::getInt32Ty(theContext)},
+      {"int64", llvm::Type::getInt64Ty(theContext)},
       {"int8", llvm::Type::getInt8Ty(theContext)},
       {"void", llvm::Type::getVoidTy(theContext)},
   };
@@ -188,10 +473,10 @@ llvm::Value *al::CompileTime::createGetMemNvmVar(const std::string &name) {
     abort();
   }
 
-  int varId = name[name.size() - 1] - '0';
+  int varId = getNvmVarId(name);
   auto type = this->getSymbolType(name);
   auto t = type->getLlvmType();
-  if (t->isPointerTy()) {
+  if (t->isPointerTy() && !isRcType(t)) {
     t = PointerType::get(t->getPointerElementType(), PtrAddressSpace::NVM);
   }
 
@@ -204,7 +489,7 @@ void al::CompileTime::createSetMemNvmVar(const std::string &name, llvm::Value *p
     abort();
   }
 
-  int varId = name[name.size() - 1] - '0';
+  int varId = getNvmVarId(name);
   auto t = this->getSymbolType(name)->getLlvmType();
   auto sizeVal = this->getCompilerContext().builder->CreatePtrToInt(
       this->getCompilerContext().builder->CreateGEP(
@@ -314,6 +599,30 @@ void al::CompileTime::createCommitPersistentVarIfOk(llvm::Value *nvmPtr, llvm::V
   );
 
   auto l = llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(theContext), 1);
+  if (this->config.enablePersistStats || this->config.enablePersistTrace) {
+    auto siteId = registerPersistSite();
+    auto siteFn = getMainModule()->getOrInsertFunction(
+        "persistNvmVarByAddrAt",
+        FunctionType::get(
+            Type::getVoidTy(theContext), {
+                Type::getInt32PtrTy(theContext),
+                Type::getInt64Ty(theContext),
+                Type::getInt32Ty(theContext),
+                Type::getInt32Ty(theContext)
+            },
+            false
+        )
+    );
+    getCompilerContext().builder->CreateCall(
+        siteFn, {
+            getCompilerContext().builder->CreatePointerCast(nvmPtr, Type::getInt32PtrTy(theContext)),
+            size,
+            ok == nullptr ? l : ok,
+            ConstantInt::get(Type::getInt32Ty(theContext), siteId)
+        }
+    );
+    return;
+  }
   getCompilerContext().builder->CreateCall(
       fn, {
           getCompilerContext().builder->CreatePointerCast(nvmPtr, Type::getInt32PtrTy(theContext)),
@@ -323,6 +632,522 @@ void al::CompileTime::createCommitPersistentVarIfOk(llvm::Value *nvmPtr, llvm::V
   );
 }
 
+int al::CompileTime::registerPersistSite() {
+  this->persistSites.emplace_back(this->currentLine, getCompilerContext().function->getName().str());
+  return (int)this->persistSites.size() - 1;
+}
+
+void al::CompileTime::createTraceStore(llvm::Value *ptr, llvm::Type *type) {
+  auto fn = getMainModule()->getOrInsertFunction(
+      "alTraceStore",
+      FunctionType::get(
+          Type::getVoidTy(theContext),
+          {Type::getInt8PtrTy(theContext), Type::getInt64Ty(theContext), Type::getInt32Ty(theContext)},
+          false
+      )
+  );
+  auto &builder = *getCompilerContext().builder;
+  builder.CreateCall(fn, {
+      builder.CreatePointerCast(ptr, Type::getInt8PtrTy(theContext)),
+      getTypeSize(builder, type),
+      ConstantInt::get(Type::getInt32Ty(theContext), registerPersistSite())
+  });
+}
+
+void al::CompileTime::createPersistSites() {
+  /**
+   * struct AlPersistSite {
+   *   int32_t line;
+   *   const char *function;
+   * } al_persist_sites[];
+   */
+  auto i8PtrType = Type::getInt8PtrTy(theContext);
+  auto siteType = StructType::get(theContext, {Type::getInt32Ty(theContext), i8PtrType}, false);
+
+  std::vector<Constant*> sites;
+  for (auto &site : this->persistSites) {
+    sites.push_back(ConstantStruct::get(siteType, {
+        ConstantInt::get(Type::getInt32Ty(theContext), site.first),
+        createStringConstant(site.second, "al_persist_site_fn")
+    }));
+  }
+  auto sitesType = ArrayType::get(siteType, sites.size());
+  auto sitesVar = new GlobalVariable(
+      *getMainModule(),
+      sitesType,
+      true,
+      GlobalValue::PrivateLinkage,
+      ConstantArray::get(sitesType, sites),
+      "al_persist_sites"
+  );
+  createMainPrologueCall(
+      "alRegisterPersistSites",
+      FunctionType::get(Type::getVoidTy(theContext), {PointerType::get(siteType, 0), Type::getInt32Ty(theContext), i8PtrType}, false),
+      {
+          ConstantExpr::getPointerCast(sitesVar, PointerType::get(siteType, 0)),
+          ConstantInt::get(Type::getInt32Ty(theContext), sites.size()),
+          createStringConstant(this->config.sourcePath, "al_source_path")
+      }
+  );
+}
+
+llvm::Constant *al::CompileTime::createStringConstant(const std::string &s, const std::string &name) {
+  auto data = ConstantDataArray::getString(theContext, s);
+  auto var = new GlobalVariable(*getMainModule(), data->getType(), true, GlobalValue::PrivateLinkage, data, name);
+  return ConstantExpr::getPointerCast(var, Type::getInt8PtrTy(theContext));
+}
+
+void al::CompileTime::loadProfile() {
+  /**
+   * al-profile 1
+   * <function> <entry count> <number of branches>
+   * <true count> <false count>    one line per branch
+   */
+  ifstream in(config.profileUse);
+  std::string magic;
+  int version = 0;
+  if (!(in >> magic >> version) || magic != "al-profile" || version != 1) {
+    cerr << "cannot read profile " << config.profileUse << endl;
+    abort();
+  }
+  std::string name;
+  uint64_t entryCount;
+  uint32_t nBranches;
+  while (in >> name >> entryCount >> nBranches) {
+    auto &function = profile[name];
+    function.entryCount = entryCount;
+    function.branches.resize(nBranches);
+    for (auto &branch : function.branches) {
+      if (!(in >> branch.trueCount >> branch.falseCount)) {
+        cerr << "cannot read profile " << config.profileUse << ": truncated branches of " << name << endl;
+        abort();
+      }
+      branch.known = true;
+    }
+  }
+  // the loop stops at the first line it cannot read, which must be the end
+  if (!in.eof()) {
+    cerr << "cannot read profile " << config.profileUse << ": bad function line" << endl;
+    abort();
+  }
+}
+
+void al::CompileTime::createProfileCount(llvm::Value *index) {
+  auto builder = getCompilerContext().builder;
+  auto i64 = Type::getInt64Ty(theContext);
+  if (profileCounters == nullptr) {
+    // the number of counters is known at the end, createProfileCounters replaces this
+    profileCounters = new GlobalVariable(*getMainModule(), i64, false, GlobalValue::ExternalLinkage, nullptr, "al_profile_counters");
+  }
+  auto counter = builder->CreateInBoundsGEP(profileCounters, index);
+  builder->CreateStore(builder->CreateAdd(builder->CreateLoad(counter), ConstantInt::get(i64, 1)), counter);
+}
+
+void al::CompileTime::createProfileEntry(llvm::Function *fn) {
+  if (config.profileGenerate.empty() && config.profileUse.empty()) {
+    return;
+  }
+  profiledFunctions.emplace_back(fn->getName().str(), nProfileCounters, 0);
+  if (!config.profileGenerate.empty()) {
+    createProfileCount(ConstantInt::get(Type::getInt64Ty(theContext), nProfileCounters));
+  } else {
+    auto it = profile.find(fn->getName().str());
+    if (it != profile.end()) {
+      fn->setEntryCount(it->second.entryCount);
+    }
+  }
+  nProfileCounters++;
+}
+
+al::ProfileBranch al::CompileTime::createProfiledCondBr(llvm::Value *cond, llvm::BasicBlock *trueBlock, llvm::BasicBlock *falseBlock) {
+  auto builder = getCompilerContext().builder;
+  ProfileBranch counts;
+  if (profiledFunctions.empty() || std::get<0>(profiledFunctions.back()) != getCompilerContext().function->getName()) {
+    builder->CreateCondBr(cond, trueBlock, falseBlock);
+    return counts;
+  }
+  auto &function = profiledFunctions.back();
+  auto branch = std::get<2>(function)++;
+  if (!config.profileGenerate.empty()) {
+    // the true edge counts at nProfileCounters, the false edge right after it
+    auto i64 = Type::getInt64Ty(theContext);
+    createProfileCount(builder->CreateSub(
+        ConstantInt::get(i64, nProfileCounters + 1),
+        builder->CreateZExt(cond, i64)
+    ));
+    nProfileCounters += 2;
+    builder->CreateCondBr(cond, trueBlock, falseBlock);
+    return counts;
+  }
+
+  auto it = profile.find(std::get<0>(function));
+  if (it != profile.end() && branch < it->second.branches.size()) {
+    counts = it->second.branches[branch];
+  }
+  MDNode *weights = nullptr;
+  if (counts.trueCount > 0 || counts.falseCount > 0) {
+    // weights are 32 bit, scale both down the same
+    auto scale = std::max<uint64_t>(1, std::max(counts.trueCount, counts.falseCount) / UINT32_MAX + 1);
+    weights = MDBuilder(theContext).createBranchWeights(
+        (uint32_t)(counts.trueCount / scale),
+        (uint32_t)(counts.falseCount / scale)
+    );
+  }
+  builder->CreateCondBr(cond, trueBlock, falseBlock, weights);
+  return counts;
+}
+
+int al::CompileTime::getBatchCount(int annotatedCount, const ProfileBranch &loop) const {
+  // the true edge of a for condition leaves the loop, it is taken once per run of the loop
+  if (!loop.known || loop.trueCount == 0) {
+    // without a profile @batch(var, 0) persists every iteration
+    return annotatedCount > 0 ? annotatedCount : 1;
+  }
+  auto trips = loop.falseCount / loop.trueCount;
+  if (annotatedCount == 0) {
+    return (int)std::max<uint64_t>(1, std::min<uint64_t>(trips, INT32_MAX));
+  }
+  if ((uint64_t)annotatedCount > trips) {
+    cerr << config.sourcePath << ":" << currentLine << ": @batch size " << annotatedCount
+         << " is above the loop's average trip count " << trips << ", use @batch(var, 0)" << endl;
+  }
+  return annotatedCount;
+}
+
+void al::CompileTime::createProfileCounters() {
+  /**
+   * struct AlProfileFunction {
+   *   const char *name;
+   *   uint32_t firstCounter;
+   *   uint32_t nBranches;
+   * } al_profile_functions[];
+   */
+  if (profileCounters == nullptr) {
+    return;
+  }
+  auto i64 = Type::getInt64Ty(theContext);
+  auto i32 = Type::getInt32Ty(theContext);
+  auto i8PtrType = Type::getInt8PtrTy(theContext);
+  auto countersType = ArrayType::get(i64, nProfileCounters);
+  auto counters = new GlobalVariable(
+      *getMainModule(), countersType, false, GlobalValue::PrivateLinkage, ConstantAggregateZero::get(countersType)
+  );
+  counters->takeName(profileCounters);
+  profileCounters->replaceAllUsesWith(ConstantExpr::getPointerCast(counters, PointerType::get(i64, 0)));
+  profileCounters->eraseFromParent();
+  profileCounters = counters;
+
+  auto functionType = StructType::get(theContext, {i8PtrType, i32, i32}, false);
+  std::vector<Constant*> functions;
+  for (auto &function : profiledFunctions) {
+    functions.push_back(ConstantStruct::get(functionType, {
+        createStringConstant(std::get<0>(function), "al_profile_fn"),
+        ConstantInt::get(i32, std::get<1>(function)),
+        ConstantInt::get(i32, std::get<2>(function))
+    }));
+  }
+  auto functionsType = ArrayType::get(functionType, functions.size());
+  auto functionsVar = new GlobalVariable(
+      *getMainModule(),
+      functionsType,
+      true,
+      GlobalValue::PrivateLinkage,
+      ConstantArray::get(functionsType, functions),
+      "al_profile_functions"
+  );
+  createMainPrologueCall(
+      "alRegisterProfile",
+      FunctionType::get(Type::getVoidTy(theContext), {PointerType::get(i64, 0), PointerType::get(functionType, 0), i32, i8PtrType}, false),
+      {
+          ConstantExpr::getPointerCast(counters, PointerType::get(i64, 0)),
+          ConstantExpr::getPointerCast(functionsVar, PointerType::get(functionType, 0)),
+          ConstantInt::get(i32, functions.size()),
+          createStringConstant(this->config.profileGenerate, "al_profile_path")
+      }
+  );
+}
+
+void al::CompileTime::createProfileSummary() {
+  // the optimizer only treats counts as hot or cold relative to a module summary
+  std::vector<uint64_t> counts;
+  uint64_t maxFunctionCount = 0;
+  uint32_t nFunctions = 0;
+  for (auto &function : profiledFunctions) {
+    auto it = profile.find(std::get<0>(function));
+    if (it == profile.end()) {
+      continue;
+    }
+    if (it->second.branches.size() != std::get<2>(function)) {
+      cerr << "profile of " << std::get<0>(function) << " does not match " << config.sourcePath
+           << ", regenerate " << config.profileUse << endl;
+      abort();
+    }
+    nFunctions++;
+    maxFunctionCount = std::max(maxFunctionCount, it->second.entryCount);
+    counts.push_back(it->second.entryCount);
+    for (auto &branch : it->second.branches) {
+      counts.push_back(branch.trueCount);
+      counts.push_back(branch.falseCount);
+    }
+  }
+  if (counts.empty()) {
+    return;
+  }
+  std::sort(counts.begin(), counts.end(), std::greater<uint64_t>());
+  double total = 0;
+  for (auto count : counts) {
+    total += count;
+  }
+  ProfileSummary::SummaryEntryVector detailed;
+  size_t i = 0;
+  double sum = 0;
+  for (uint32_t cutoff : {10000, 100000, 200000, 300000, 400000, 500000, 600000, 700000, 800000,
+                          900000, 950000, 990000, 999000, 999900, 999990, 999999}) {
+    // the fewest, largest counts adding up to cutoff / 1000000 of the total
+    while (i < counts.size() && sum < total * cutoff / ProfileSummary::Scale) {
+      sum += counts[i++];
+    }
+    detailed.emplace_back(cutoff, counts[i == 0 ? 0 : i - 1], i);
+  }
+  ProfileSummary summary(
+      ProfileSummary::PSK_Instr, detailed, (uint64_t)total, counts.front(), counts.front(),
+      maxFunctionCount, counts.size(), nFunctions
+  );
+  getMainModule()->setProfileSummary(summary.getMD(theContext));
+}
+
+void al::CompileTime::createGcWriteBarrier(llvm::Value *slot, llvm::Value *newVal) {
+  /**
+   * if (alGcMarking) alGcWriteBarrier(slot, newVal);
+   * The flag is only set by the collector during an incremental mark,
+   * so the common case costs one load and a well predicted branch.
+   */
+  auto builder = getCompilerContext().builder;
+  auto i8PtrType = Type::getInt8PtrTy(theContext);
+  auto markingFlag = getMainModule()->getOrInsertGlobal("alGcMarking", Type::getInt32Ty(theContext));
+  auto marking = builder->CreateLoad(markingFlag, true);
+
+  auto function = getCompilerContext().function;
+  auto barrierBlock = BasicBlock::Create(theContext, "gc_barrier", function);
+  auto nextBlock = BasicBlock::Create(theContext, "gc_barrier_next", function);
+  builder->CreateCondBr(
+      builder->CreateICmpNE(marking, ConstantInt::get(Type::getInt32Ty(theContext), 0)),
+      barrierBlock,
+      nextBlock
+  );
+
+  builder->SetInsertPoint(barrierBlock);
+  auto fn = getMainModule()->getOrInsertFunction(
+      "alGcWriteBarrier",
+      FunctionType::get(Type::getVoidTy(theContext), {PointerType::get(i8PtrType, 0), i8PtrType}, false)
+  );
+  builder->CreateCall(fn, {
+      builder->CreatePointerCast(slot, PointerType::get(i8PtrType, 0)),
+      builder->CreatePointerCast(newVal, i8PtrType)
+  });
+  builder->CreateBr(nextBlock);
+
+  builder->SetInsertPoint(nextBlock);
+  getCompilerContext().basicBlock = nextBlock;
+}
+
+bool al::CompileTime::isGcRootType(llvm::Type *type) const {
+  return this->config.enableGcShadowStack &&
+      type->isPointerTy() &&
+      type->getPointerAddressSpace() == PtrAddressSpace::NVM;
+}
+
+void al::CompileTime::registerGcRoot(llvm::Value *alloca) {
+  this->gcRoots.push_back(alloca);
+}
+
+void al::CompileTime::createGcRootFrame() {
+  if (this->gcRoots.empty()) {
+    return;
+  }
+
+  /**
+   * struct AlGcFrame {
+   *   AlGcFrame *prev;
+   *   uint32_t nRoots;
+   *   void **roots[nRoots];
+   * };
+   */
+  auto function = getCompilerContext().function;
+  auto i8PtrType = Type::getInt8PtrTy(theContext);
+  auto slotType = PointerType::get(i8PtrType, 0);
+  auto frameType = StructType::get(theContext, {
+      i8PtrType,
+      Type::getInt32Ty(theContext),
+      ArrayType::get(slotType, this->gcRoots.size())
+  }, false);
+
+  /**
+   * Link the frame right after the last root alloca of the entry block. All roots are
+   * allocated in the entry block, argument roots before the arguments are stored, so
+   * the null stores below come after every root alloca and before any store to them.
+   */
+  auto &entry = function->getEntryBlock();
+  auto it = entry.begin();
+  for (auto inst = entry.begin(); inst != entry.end(); ++inst) {
+    if (std::find(this->gcRoots.begin(), this->gcRoots.end(), &*inst) != this->gcRoots.end()) {
+      it = std::next(inst);
+    }
+  }
+  IRBuilder<> builder(&entry, it);
+  auto frame = builder.CreateAlloca(frameType);
+  auto chainFn = getMainModule()->getOrInsertFunction(
+      "alGcRootChain",
+      FunctionType::get(PointerType::get(i8PtrType, 0), {}, false)
+  );
+  auto chain = builder.CreateCall(chainFn, {});
+  auto prev = builder.CreateLoad(chain);
+  auto zero = ConstantInt::get(Type::getInt32Ty(theContext), 0);
+  builder.CreateStore(prev, builder.CreateGEP(frame, {zero, zero}));
+  builder.CreateStore(
+      ConstantInt::get(Type::getInt32Ty(theContext), this->gcRoots.size()),
+      builder.CreateGEP(frame, {zero, ConstantInt::get(Type::getInt32Ty(theContext), 1)})
+  );
+  for (size_t i = 0; i < this->gcRoots.size(); ++i) {
+    auto root = this->gcRoots[i];
+    builder.CreateStore(
+        ConstantPointerNull::get(static_cast<PointerType*>(root->getType()->getPointerElementType())),
+        root
+    );
+    builder.CreateStore(
+        builder.CreatePointerCast(root, slotType),
+        builder.CreateGEP(frame, {
+            zero,
+            ConstantInt::get(Type::getInt32Ty(theContext), 2),
+            ConstantInt::get(Type::getInt32Ty(theContext), i)
+        })
+    );
+  }
+  builder.CreateStore(builder.CreatePointerCast(frame, i8PtrType), chain);
+
+  // Unlink before every return
+  for (auto &bb : *function) {
+    auto ret = dyn_cast_or_null<ReturnInst>(bb.getTerminator());
+    if (ret) {
+      IRBuilder<> retBuilder(ret);
+      retBuilder.CreateStore(prev, chain);
+    }
+  }
+
+  this->gcRoots.clear();
+}
+
+bool al::CompileTime::containsNvmPtr(llvm::Type *type) {
+  if (type->isPointerTy()) {
+    return isNvmAddressSpace(type->getPointerAddressSpace());
+  }
+  if (type->isStructTy()) {
+    for (unsigned i = 0; i < type->getStructNumElements(); ++i) {
+      if (containsNvmPtr(type->getStructElementType(i))) {
+        return true;
+      }
+    }
+  }
+  if (type->isArrayTy()) {
+    return containsNvmPtr(type->getArrayElementType());
+  }
+  return false;
+}
+
+llvm::Value *al::CompileTime::getNvmBase() {
+  auto function = getCompilerContext().function;
+  auto it = this->nvmBases.find(function);
+  if (it != this->nvmBases.end()) {
+    return it->second;
+  }
+  // al_nvm_base is set by nvmSetup before AL__main, load it once at the function entry
+  auto &entry = function->getEntryBlock();
+  IRBuilder<> builder(&entry, entry.begin());
+  auto baseVar = getMainModule()->getOrInsertGlobal("al_nvm_base", Type::getInt64Ty(theContext));
+  auto base = builder.CreateLoad(baseVar, "nvm_base");
+  this->nvmBases[function] = base;
+  return base;
+}
+
+llvm::Value *al::CompileTime::createNvmPtrConversion(llvm::Value *val, bool toRelative) {
+  auto &builder = *getCompilerContext().builder;
+  auto type = val->getType();
+  if (type->isStructTy()) {
+    for (unsigned i = 0; i < type->getStructNumElements(); ++i) {
+      if (containsNvmPtr(type->getStructElementType(i))) {
+        auto member = createNvmPtrConversion(builder.CreateExtractValue(val, {i}), toRelative);
+        val = builder.CreateInsertValue(val, member, {i});
+      }
+    }
+    return val;
+  }
+  if (type->isArrayTy()) {
+    for (unsigned i = 0; i < type->getArrayNumElements(); ++i) {
+      auto element = createNvmPtrConversion(builder.CreateExtractValue(val, {i}), toRelative);
+      val = builder.CreateInsertValue(val, element, {i});
+    }
+    return val;
+  }
+  if (!type->isPointerTy() || !isNvmAddressSpace(type->getPointerAddressSpace())) {
+    return val;
+  }
+
+  // null <-> 0, ptr <-> ptr - base
+  auto i64Type = Type::getInt64Ty(theContext);
+  auto zero = ConstantInt::get(i64Type, 0);
+  auto i = builder.CreatePtrToInt(val, i64Type);
+  auto converted = toRelative ? builder.CreateSub(i, getNvmBase()) : builder.CreateAdd(i, getNvmBase());
+  return builder.CreateIntToPtr(builder.CreateSelect(builder.CreateICmpEQ(i, zero), zero, converted), type);
+}
+
+llvm::Value *al::CompileTime::createLoad(llvm::Value *ptr) {
+  auto val = getCompilerContext().builder->CreateLoad(ptr);
+  if (this->config.enableRelativeNvmPtr &&
+      isNvmAddressSpace(ptr->getType()->getPointerAddressSpace()) &&
+      containsNvmPtr(val->getType())) {
+    return createNvmPtrConversion(val, false);
+  }
+  return val;
+}
+
+bool al::CompileTime::isRcType(llvm::Type *type) {
+  return type->isPointerTy() && type->getPointerAddressSpace() == PtrAddressSpace::NVMRc;
+}
+
+bool al::CompileTime::containsRcType(llvm::Type *type) {
+  if (isRcType(type)) {
+    return true;
+  }
+  if (type->isStructTy()) {
+    for (unsigned i = 0; i < type->getStructNumElements(); ++i) {
+      if (containsRcType(type->getStructElementType(i))) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void al::CompileTime::createRcInc(llvm::Value *rcPtr) {
+  auto fn = getMainModule()->getOrInsertFunction(
+      "alRcInc",
+      FunctionType::get(Type::getVoidTy(theContext), {Type::getInt8PtrTy(theContext)}, false)
+  );
+  getCompilerContext().builder->CreateCall(fn, {
+      getCompilerContext().builder->CreatePointerCast(rcPtr, Type::getInt8PtrTy(theContext))
+  });
+}
+
+void al::CompileTime::createRcDec(llvm::Value *rcPtr) {
+  auto fn = getMainModule()->getOrInsertFunction(
+      "alRcDec",
+      FunctionType::get(Type::getVoidTy(theContext), {Type::getInt8PtrTy(theContext)}, false)
+  );
+  getCompilerContext().builder->CreateCall(fn, {
+      getCompilerContext().builder->CreatePointerCast(rcPtr, Type::getInt8PtrTy(theContext))
+  });
+}
+
 void al::CompileTime::createAssignment(
     llvm::Type *elementType,
     llvm::Value *lhsPtr,
@@ -336,13 +1161,56 @@ void al::CompileTime::createAssignment(
     ast::Type::arrayCopy(*getMainModule(), *getCompilerContext().builder, lhsPtr, rhsPtr);
   } else {
     if (elementType->isIntegerTy(32) ||
+        elementType->isIntegerTy(64) ||
         elementType->isPointerTy() ||
         elementType->isStructTy()) {
       auto a = static_cast<llvm::PointerType*>(lhsPtr->getType());
       auto vPtr = llvm::PointerType::get(a->getElementType(), PtrAddressSpace::Volatile);
       auto lhsNewPtr = getCompilerContext().builder->CreatePointerCast(lhsPtr, vPtr);
 
-      getCompilerContext().builder->CreateStore(rhsVal, lhsNewPtr);
+      if (elementType->isStructTy() && containsRcType(elementType)) {
+        cerr << "copying structs with rc members is not supported" << endl;
+        abort();
+      }
+      if (elementType->isIntegerTy() && rhsVal->getType() != elementType) {
+        // e.g. int32 literals into int64
+        rhsVal = createIntConversion(rhsVal, elementType);
+      }
+      if (elementType->isPointerTy() && rhsVal->getType() != elementType) {
+        // only null converts between pointer types
+        if (!isa<ConstantPointerNull>(rhsVal)) {
+          std::string lhsName, rhsName;
+          raw_string_ostream lhsStream(lhsName), rhsStream(rhsName);
+          elementType->print(lhsStream);
+          rhsVal->getType()->print(rhsStream);
+          cerr << "cannot assign '" << rhsStream.str() << "' to '" << lhsStream.str() << "'" << endl;
+          abort();
+        }
+        rhsVal = ConstantPointerNull::get(static_cast<llvm::PointerType*>(elementType));
+      }
+
+      if (this->config.enableGcWriteBarrier &&
+          elementType->isPointerTy() &&
+          isNvmAddressSpace(lhsPtr->getType()->getPointerAddressSpace())) {
+        createGcWriteBarrier(lhsNewPtr, rhsVal);
+      }
+      auto storedVal = rhsVal;
+      if (this->config.enableRelativeNvmPtr &&
+          isNvmAddressSpace(lhsPtr->getType()->getPointerAddressSpace()) &&
+          containsNvmPtr(elementType)) {
+        storedVal = createNvmPtrConversion(rhsVal, true);
+      }
+      if (isRcType(elementType)) {
+        createRcInc(rhsVal);
+        auto oldVal = createLoad(lhsPtr);
+        getCompilerContext().builder->CreateStore(storedVal, lhsNewPtr);
+        createRcDec(oldVal);
+      } else {
+        getCompilerContext().builder->CreateStore(storedVal, lhsNewPtr);
+      }
+      if (this->config.enablePersistTrace && isNvmAddressSpace(lhsPtr->getType()->getPointerAddressSpace())) {
+        createTraceStore(lhsNewPtr, elementType);
+      }
     }
     else {
       cerr << "type not supported" << endl;
@@ -352,7 +1220,7 @@ void al::CompileTime::createAssignment(
 
     // TODO: fix this
     if (!this->config.enableOptFlushOnlyNvm ||
-        (persistNvm && lhsPtr->getType()->getPointerAddressSpace() == PtrAddressSpace::NVM)) {
+        (persistNvm && isNvmAddressSpace(lhsPtr->getType()->getPointerAddressSpace()))) {
 
 //      // TODO: persistNvm is for performance test of batch op
 //      if (persistNvm == nullptr) {
@@ -367,6 +1235,16 @@ void al::CompileTime::createAssignment(
   }
 }
 
+llvm::Value *al::CompileTime::createIntConversion(llvm::Value *val, llvm::Type *type) {
+  auto fromBits = val->getType()->getIntegerBitWidth();
+  auto toBits = type->getIntegerBitWidth();
+  if (fromBits > toBits) {
+    cerr << "cannot convert int" << fromBits << " to int" << toBits << " implicitly" << endl;
+    abort();
+  }
+  return getCompilerContext().builder->CreateSExt(val, type);
+}
+
 llvm::Value *al::CompileTime::getFunctionStackVariable(const std::string &functionName, const std::string &varName) {
   return this->functionStackVariables[functionName][varName];
 }
@@ -393,6 +1271,17 @@ void al::CompileTime::registerSymbol(const std::string &name, std::shared_ptr<al
     abort();
   }
   this->globalSymbolTable[name] = type;
+  // ids are given in declaration order, they name the persistent var in the pool
+  this->nvmVarIds.emplace(name, (int)this->nvmVarIds.size());
+}
+
+int al::CompileTime::getNvmVarId(const std::string &name) const {
+  auto it = this->nvmVarIds.find(name);
+  if (it == this->nvmVarIds.end()) {
+    cerr << "Persistent var not found '" << name << "'" << endl;
+    abort();
+  }
+  return it->second;
 }
 
 void al::CompileTime::registerType(const std::string &name, std::shared_ptr<al::ast::Type> type) {
@@ -408,9 +1297,210 @@ void al::CompileTime::unsetFunctionStackVariable(const std::string &functionName
   }
 }
 
+void al::CompileTime::createRegionEnter() {
+  auto fn = getMainModule()->getOrInsertFunction(
+      "alRegionEnter",
+      FunctionType::get(Type::getVoidTy(theContext), {}, false)
+  );
+  getCompilerContext().builder->CreateCall(fn, {});
+  this->regionDepth++;
+}
+
+void al::CompileTime::createRegionLeave() {
+  if (this->regionDepth <= 0) {
+    cerr << "leaving a region without entering it" << endl;
+    abort();
+  }
+  this->regionDepth--;
+  auto fn = getMainModule()->getOrInsertFunction(
+      "alRegionLeave",
+      FunctionType::get(Type::getVoidTy(theContext), {Type::getInt32Ty(theContext)}, false)
+  );
+  getCompilerContext().builder->CreateCall(fn, {ConstantInt::get(Type::getInt32Ty(theContext), 1)});
+}
+
+void al::CompileTime::createRegionUnwind(int depth) {
+  if (this->regionDepth <= depth) {
+    return;
+  }
+  auto fn = getMainModule()->getOrInsertFunction(
+      "alRegionLeave",
+      FunctionType::get(Type::getVoidTy(theContext), {Type::getInt32Ty(theContext)}, false)
+  );
+  getCompilerContext().builder->CreateCall(
+      fn,
+      {ConstantInt::get(Type::getInt32Ty(theContext), (uint64_t)(this->regionDepth - depth))}
+  );
+}
+
+void al::CompileTime::createReturnUnwind() {
+  createRegionUnwind(0);
+  createStackScopeEnd(0);
+  for (auto arg : this->rcArgs) {
+    createRcDec(getCompilerContext().builder->CreateLoad(arg));
+  }
+}
+
+void al::CompileTime::createLoopUnwind() {
+  auto &loop = *(this->loopScopes.end() - 1);
+  createRegionUnwind(loop.regionDepth);
+  createStackScopeEnd(loop.stackScopeDepth);
+}
+
+llvm::Value *al::CompileTime::createEntryAlloca(llvm::Type *type, llvm::Value *arraySize) {
+  auto &entry = getCompilerContext().function->getEntryBlock();
+  IRBuilder<> builder(&entry, entry.begin());
+  return builder.CreateAlloca(type, arraySize);
+}
+
+llvm::Value *al::CompileTime::createScopedAlloca(llvm::Type *type) {
+  auto var = createEntryAlloca(type);
+  if (isGcRootType(type)) {
+    // The collector may read the slot at any time, it must not be shared with other variables
+    registerGcRoot(var);
+    return var;
+  }
+  auto size = getMainModule()->getDataLayout().getTypeAllocSize(type);
+  auto start = getCompilerContext().builder->CreateLifetimeStart(
+      var,
+      ConstantInt::get(Type::getInt64Ty(theContext), size)
+  );
+  (this->stackScopes.end() - 1)->allocas.emplace_back(var, size, start);
+  if (isRcType(type)) {
+    // the first assignment releases the old value
+    getCompilerContext().builder->CreateStore(ConstantPointerNull::get(static_cast<PointerType*>(type)), var);
+    (this->stackScopes.end() - 1)->rcSlots.push_back(var);
+  }
+  return var;
+}
+
+llvm::Value *al::CompileTime::createScopedArray(llvm::PointerType *arrPtrType, llvm::Value *len) {
+  auto &builder = *getCompilerContext().builder;
+  if (isa<ConstantInt>(len)) {
+    auto totalLen = dyn_cast<ConstantInt>(ast::Type::sizeOfArray(*getMainModule(), builder, arrPtrType, len));
+    auto var = createEntryAlloca(Type::getInt8Ty(theContext), totalLen);
+    auto arr = builder.CreatePointerCast(var, arrPtrType);
+    auto start = builder.CreateLifetimeStart(var, totalLen);
+    (this->stackScopes.end() - 1)->allocas.emplace_back(arr, totalLen->getZExtValue(), start);
+    return arr;
+  }
+
+  auto &scope = *(this->stackScopes.end() - 1);
+  if (scope.savedStack == nullptr) {
+    scope.savedStack = builder.CreateCall(Intrinsic::getDeclaration(getMainModule(), Intrinsic::stacksave), {});
+  }
+  return ast::Type::createArrayByAlloca(*getMainModule(), builder, arrPtrType, len);
+}
+
+bool al::CompileTime::moveScopedAlloca(llvm::Value *from, llvm::Value *to) {
+  // variables not declared in a stack scope (arguments) live as long as the function
+  size_t toDepth = 0;
+  bool toScoped = false;
+  size_t fromDepth = this->stackScopes.size() - 1;
+  for (size_t i = 0; i < this->stackScopes.size(); ++i) {
+    for (auto &alloca : this->stackScopes[i].allocas) {
+      if (std::get<0>(alloca) == to) {
+        toDepth = i;
+        toScoped = true;
+      }
+      if (std::get<0>(alloca) == from) {
+        fromDepth = i;
+      }
+    }
+  }
+  for (auto &loop : this->loopScopes) {
+    if ((!toScoped || toDepth < loop.stackScopeDepth) && loop.stackScopeDepth <= fromDepth) {
+      auto &builder = *getCompilerContext().builder;
+      auto value = builder.CreateLoad(from);
+      for (auto &scope : this->stackScopes) {
+        auto it = std::find(scope.rcSlots.begin(), scope.rcSlots.end(), from);
+        if (it != scope.rcSlots.end()) {
+          // the reference moves to `to`, whose old one is released
+          scope.rcSlots.erase(it);
+          createRcDec(builder.CreateLoad(to));
+        }
+      }
+      builder.CreateStore(value, to);
+      return false;
+    }
+  }
+
+  StackScope *toScope = &this->stackScopes[toDepth];
+  for (auto &scope : this->stackScopes) {
+    for (auto it = scope.allocas.begin(); it != scope.allocas.end(); ++it) {
+      if (std::get<0>(*it) == from) {
+        std::get<2>(*it)->eraseFromParent();
+        scope.allocas.erase(it);
+        break;
+      }
+    }
+    auto it = std::find(scope.rcSlots.begin(), scope.rcSlots.end(), from);
+    if (it != scope.rcSlots.end()) {
+      scope.rcSlots.erase(it);
+      toScope->rcSlots.push_back(from);
+    }
+  }
+  return true;
+}
+
+void al::CompileTime::createStackScopeEnd(size_t depth) {
+  auto &builder = *getCompilerContext().builder;
+  llvm::Value *savedStack = nullptr;
+  for (size_t i = this->stackScopes.size(); i > depth; --i) {
+    auto &scope = this->stackScopes[i - 1];
+    for (auto slot : scope.rcSlots) {
+      createRcDec(builder.CreateLoad(slot));
+    }
+    for (auto &alloca : scope.allocas) {
+      builder.CreateLifetimeEnd(
+          std::get<0>(alloca),
+          ConstantInt::get(Type::getInt64Ty(theContext), std::get<1>(alloca))
+      );
+    }
+    if (scope.savedStack) {
+      savedStack = scope.savedStack;
+    }
+  }
+  // the outermost saved stack frees all dynamic arrays of the inner scopes as well
+  if (savedStack) {
+    builder.CreateCall(Intrinsic::getDeclaration(getMainModule(), Intrinsic::stackrestore), {savedStack});
+  }
+}
+
+void al::CompileTime::popStackScope() {
+  // Nothing to release after a return, the frame is gone
+  if (getCompilerContext().builder->GetInsertBlock()->getTerminator() == nullptr) {
+    createStackScopeEnd(this->stackScopes.size() - 1);
+  }
+  this->stackScopes.pop_back();
+}
+
 al::CompilerConfig al::CompilerConfig::parseFromArgs(int argc, char **argv) {
   CompilerConfig config;
   ArgParser parser(argc, argv);
   config.enableOptFlushOnlyNvm = parser.getCmdOption("--enable-opt-flush-only-nvm", true);
+  config.enableOptBatch = parser.getCmdOption("--enable-opt-batch", true);
+  config.enableGcWriteBarrier = parser.getCmdOption("--enable-gc-write-barrier", false);
+  config.enableGcShadowStack = parser.getCmdOption("--enable-gc-shadow-stack", false);
+  config.enableRelativeNvmPtr = parser.getCmdOption("--enable-relative-nvm-ptr", false);
+  config.enablePersistStats = parser.getCmdOption("--enable-persist-stats", false);
+  config.enablePersistTrace = parser.getCmdOption("--enable-persist-trace", false);
+  config.timePhases = parser.getCmdOption("--time-phases", false);
+  config.enableLazyJit = parser.getCmdOption("--enable-lazy-jit", true);
+  config.jitCacheDir = parser.getCmdOption("--jit-cache-dir");
+  config.enableSpeculativeJit = parser.getCmdOption("--enable-speculative-jit", true);
+  config.enableTieredJit = parser.getCmdOption("--enable-tiered-jit", false);
+  config.tierUpThreshold = parser.getCmdOption("--tier-up-threshold", 1000u);
+  config.tierUpOptLevel = parser.getCmdOption("--tier-up-opt-level", 2u);
+  config.march = parser.getCmdOption("--march");
+  config.mcpu = parser.getCmdOption("--mcpu");
+  config.profileGenerate = parser.getCmdOption("--profile-generate");
+  config.profileUse = parser.getCmdOption("--profile-use");
+  config.enablePerfMap = parser.getCmdOption("--enable-perf-map", false);
+  config.enableJitdump = parser.getCmdOption("--enable-jitdump", false);
+  config.enableDebugInfo = parser.getCmdOption("--debug-info", false) || config.enableJitdump;
+  config.nvmCompact = parser.getCmdOption("--nvm-compact");
+  config.nvmCompactOrder = parser.getCmdOption("--nvm-compact-order", 0);
+  config.sourcePath = argv[argc - 1];
   return config;
 }
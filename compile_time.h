@@ -5,7 +5,10 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/Target/TargetMachine.h"
 #include <map>
+#include <tuple>
 #include "ast.h"
 
 
@@ -47,12 +50,76 @@ namespace al {
 
   enum PtrAddressSpace {
     Volatile = 0,
-    NVM = 1
+    NVM = 1,
+    // rc<persistent T>, an NVM pointer whose copies are reference counted
+    NVMRc = 2
   };
+  inline bool isNvmAddressSpace(unsigned addressSpace) {
+    return addressSpace == PtrAddressSpace::NVM || addressSpace == PtrAddressSpace::NVMRc;
+  }
 
   struct CompilerConfig {
     static CompilerConfig parseFromArgs(int, char **);
     bool enableOptFlushOnlyNvm = true;
+    // @batch(var, n) loops persist var every n iterations instead of every store
+    bool enableOptBatch = true;
+    bool enableGcWriteBarrier = false;
+    bool enableGcShadowStack = false;
+    bool enableRelativeNvmPtr = false;
+    bool enablePersistStats = false;
+    bool enablePersistTrace = false;
+    // prints time and memory of each front end phase to stderr
+    bool timePhases = false;
+    // ali compiles functions on their first call instead of all up front
+    bool enableLazyJit = true;
+    // compiled objects are cached here across runs of ali, not cached if empty
+    std::string jitCacheDir;
+    // the lazy JIT compiles the callees of main ahead on a background thread
+    bool enableSpeculativeJit = true;
+    // lazy JIT functions start unoptimized, hot ones are recompiled in the background
+    bool enableTieredJit = false;
+    uint32_t tierUpThreshold = 1000;
+    unsigned tierUpOptLevel = 2;
+    // target of the generated code, the host CPU and its features if both are empty
+    std::string march;
+    std::string mcpu;
+    // profile written by the instrumented program, and the one to optimize with
+    std::string profileGenerate;
+    std::string profileUse;
+    // DWARF line tables of the .al source, for debuggers and jitdump
+    bool enableDebugInfo = false;
+    // ali writes /tmp/perf-<pid>.map and a jitdump for perf
+    bool enablePerfMap = false;
+    bool enableJitdump = false;
+    // persistent vars compacted before AL__main, in traversal (0) or allocation (1) order
+    std::string nvmCompact;
+    int32_t nvmCompactOrder = 0;
+    std::string sourcePath;
+  };
+
+  // Counts of one if or for condition from --profile-use, known if the profile has it
+  struct ProfileBranch {
+    uint64_t trueCount = 0;
+    uint64_t falseCount = 0;
+    bool known = false;
+  };
+  struct ProfileFunction {
+    uint64_t entryCount = 0;
+    std::vector<ProfileBranch> branches;
+  };
+
+  struct StackScope {
+    // alloca, size in bytes, llvm.lifetime.start call
+    std::vector<std::tuple<llvm::Value*, uint64_t, llvm::Instruction*>> allocas;
+    // llvm.stacksave result taken before the first dynamically sized alloca of this scope
+    llvm::Value *savedStack = nullptr;
+    // slots holding rc pointers, released at the end of the scope
+    std::vector<llvm::Value*> rcSlots;
+  };
+
+  struct LoopScope {
+    int regionDepth;
+    size_t stackScopeDepth;
   };
 
   struct CompilerContext {
@@ -89,6 +156,8 @@ namespace al {
     void setupMainModule();
     void createMainFunc();
     void traverseAll();
+    void traversePvarTagging();
+    void traverseCodegen();
 
     template<typename T>
     void traverse(T &t);
@@ -97,6 +166,8 @@ namespace al {
     llvm::Module* getMainModule() const;
 
     std::unique_ptr<llvm::Module> &&moveMainModule() { return std::move(mainModule); }
+    // The machine mainModule's triple and DataLayout are taken from, the JITs compile for it too
+    const llvm::TargetMachine &getTargetMachine() const { return *targetMachine; }
 
     llvm::Function *getHowAreYouFn() const { return this->howAreYou; }
 
@@ -109,8 +180,11 @@ namespace al {
     void popCurrentBlock() { this->currentBlocks.pop_back(); }
     llvm::BasicBlock *getCurrentBlock() const { return *(this->currentBlocks.end() - 1); }
     llvm::Function *getMainFunc() const { return mainFunction; }
+    // Calls made by main before AL__main, e.g. to register compiler generated tables
+    void createMainPrologueCall(const std::string &name, llvm::FunctionType *fnType, llvm::ArrayRef<llvm::Value*> args);
 
     llvm::LLVMContext &getContext() { return theContext; }
+    const CompilerConfig &getConfig() const { return config; }
 
     llvm::Value *createGetIntNvmVar(const std::string &name);
     llvm::Value *createGetMemNvmVar(const std::string &name);
@@ -118,7 +192,78 @@ namespace al {
     void createSetMemNvmVar(const std::string &name, llvm::Value *ptr);
     void createSetPersistentVar(const std::string &name, llvm::Value*);
     void createCommitPersistentVarIfOk(llvm::Value *nvmPtr, llvm::Value *size, llvm::Value *ok);
+    /**
+     * Persist statistics (--enable-persist-stats)
+     * Every emitted persist gets a site id, the runtime aggregates per site and maps
+     * them back to {line, function} through the table registered before AL__main.
+     */
+    void setCurrentLine(unsigned line) { this->currentLine = line; }
+    int registerPersistSite();
+    void createPersistSites();
+    /**
+     * Debug info (--debug-info, implied by --enable-jitdump)
+     * Every function gets a DISubprogram and every statement the line it starts on,
+     * instructions emitted between statements take the location before them.
+     */
+    void createDebugFunction(llvm::Function *fn, unsigned line);
+    void setDebugLine(unsigned line);
+    void finalizeDebugInfo();
+    /**
+     * Profile guided optimization
+     * --profile-generate <file> counts function entries and both edges of every if and
+     * for condition, the runtime writes the counts to <file> at AL__main_end.
+     * --profile-use <file> reads them back: functions get their entry count, conditions
+     * their branch weights (the weights of a for condition are its trip count) and
+     * @batch(var, 0) loops persist once per average trip count.
+     * Branches are numbered per function in codegen order, a profile only fits the source
+     * it was generated from.
+     */
+    void loadProfile();
+    void createProfileEntry(llvm::Function *fn);
+    ProfileBranch createProfiledCondBr(llvm::Value *cond, llvm::BasicBlock *trueBlock, llvm::BasicBlock *falseBlock);
+    int getBatchCount(int annotatedCount, const ProfileBranch &loop) const;
+    void createProfileCounters();
+    void createProfileSummary();
+    // Reports a store into NVM to the persist trace (--enable-persist-trace)
+    void createTraceStore(llvm::Value *ptr, llvm::Type *type);
+    void createGcWriteBarrier(llvm::Value *slot, llvm::Value *newVal);
+    /**
+     * Relative NVM pointers (--enable-relative-nvm-ptr)
+     * NVM pointers stored in NVM hold their offset from the pool base (null is 0), so
+     * pools can be mapped anywhere. createLoad/createAssignment convert at the boundary,
+     * the base is loaded once per function. Runtime out-parameters are written absolute,
+     * so passing the address of a persistent slot holding NVM pointers to an extern is
+     * rejected, nvCompact excepted.
+     */
+    llvm::Value *createLoad(llvm::Value *ptr);
+    llvm::Value *createNvmPtrConversion(llvm::Value *val, bool toRelative);
+    llvm::Value *getNvmBase();
+    static bool containsNvmPtr(llvm::Type *type);
+    /**
+     * Shadow stack (--enable-gc-shadow-stack)
+     * Stack slots holding NVM pointers are GC roots. Functions with roots link a frame
+     * {prev, nRoots, roots[]} into the thread's root chain on entry and unlink it
+     * before every return, functions without roots pay nothing.
+     */
+    bool isGcRootType(llvm::Type *type) const;
+    void registerGcRoot(llvm::Value *alloca);
+    void createGcRootFrame();
     void registerType(const std::string &name, std::shared_ptr<al::ast::Type> type);
+    /**
+     * Type descriptors, one per struct: {size, pointer bitmap, rc pointer bitmap}.
+     * Bit i of a bitmap is set if the i-th 8 byte word of the struct holds a pointer,
+     * objects allocated by nvAllocObj only carry the descriptor id in their header.
+     */
+    void registerTypeDescriptor(llvm::StructType *type);
+    int getTypeDescriptorId(llvm::StructType *type) const;
+    void createTypeDescriptors();
+    /**
+     * Offline compaction (--nvm-compact <var>[,<var>...], --nvm-compact-order 0|1)
+     * main calls nvCompact on the listed persistent vars right after the pool is opened,
+     * before AL__main runs, so no other reference into their graphs exists yet.
+     * Every object reachable from them must come from nvAllocObj.
+     */
+    void createOfflineCompaction();
     bool hasType(const std::string &name) const;
     std::shared_ptr<ast::Type> getType(const std::string &name);
 
@@ -129,6 +274,7 @@ namespace al {
     std::shared_ptr<const ast::Type> getSymbolType(const std::string &name) {
       return this->globalSymbolTable[name];
     }
+    int getNvmVarId(const std::string &name) const;
     void createAssignment(
         llvm::Type *type,
         llvm::Value *lhsPtr,
@@ -137,32 +283,109 @@ namespace al {
         llvm::Value *persistNvm = nullptr,
         bool isArray = false
     );
+    // Integers are only widened implicitly (sign extended), narrowing is a compile error
+    llvm::Value *createIntConversion(llvm::Value *val, llvm::Type *type);
     llvm::Value* getFunctionStackVariable(const std::string &functionName, const std::string &varName);
     bool hasFunctionStackVariable(const std::string &functionName, const std::string &varName);
     void setFunctionStackVariable(const std::string &functionName, const std::string &varName, llvm::Value *val);
     void unsetFunctionStackVariable(const std::string &functionName, const std::string &varName);
     PersistentVarTaggingPass &getPvarTagPass() { return *this->pvarTag; }
 
+    /**
+     * Volatile regions, every `region {}` block pushes a bump allocator in the runtime
+     * and frees everything allocated in it on leaving.
+     */
+    void createRegionEnter();
+    void createRegionLeave();
+    // Leave regions down to `depth` without closing them lexically, used by break/return
+    void createRegionUnwind(int depth);
+    int getRegionDepth() const { return regionDepth; }
+
+    /**
+     * Stack scopes, one per statement block.
+     * Fixed-size allocas are hoisted to the entry block of the function and only
+     * live between llvm.lifetime.start/end of the scope declaring them, so
+     * declarations in loops neither grow the stack nor block mem2reg.
+     * Dynamically sized arrays are released by stacksave/stackrestore.
+     */
+    void pushStackScope() { this->stackScopes.emplace_back(); }
+    void popStackScope();
+    llvm::Value *createEntryAlloca(llvm::Type *type, llvm::Value *arraySize = nullptr);
+    llvm::Value *createScopedAlloca(llvm::Type *type);
+    llvm::Value *createScopedArray(llvm::PointerType *arrPtrType, llvm::Value *len);
+    /**
+     * `from` is moved into the variable stored at `to`, it now lives as long as `to`.
+     * Returns false if a loop lies between the two scopes: `from`'s slot is reused by
+     * every iteration, so its value was copied into `to` instead.
+     */
+    bool moveScopedAlloca(llvm::Value *from, llvm::Value *to);
+
+    void pushLoopScope() { this->loopScopes.push_back({regionDepth, stackScopes.size()}); }
+    void popLoopScope() { this->loopScopes.pop_back(); }
+    // Leave all regions and stack scopes entered in the innermost loop, used by break
+    void createLoopUnwind();
+    // Leave everything entered in this function, used before returning
+    void createReturnUnwind();
+
+    /**
+     * Reference counting for rc<persistent T>
+     * Copies into any slot increment the new and decrement the old referent, rc locals
+     * and arguments are released when their scope or function is left.
+     * The runtime buffers the updates per thread and applies them in batches.
+     */
+    static bool isRcType(llvm::Type *type);
+    static bool containsRcType(llvm::Type *type);
+    void createRcInc(llvm::Value *rcPtr);
+    void createRcDec(llvm::Value *rcPtr);
+    void registerRcArg(llvm::Value *alloca) { this->rcArgs.push_back(alloca); }
+    void clearRcArgs() { this->rcArgs.clear(); }
+
   public:
     static llvm::Value *getTypeSize(llvm::IRBuilder<> &builder, llvm::Type *s);
   private:
+    void createStackScopeEnd(size_t depth);
+    void setPointerBits(std::vector<uint64_t> &bitmap, llvm::Type *type, uint64_t offset, bool rcOnly) const;
+    llvm::Constant *createStringConstant(const std::string &s, const std::string &name);
+    void createProfileCount(llvm::Value *index);
 
     llvm::Function *mainFunction;
+    llvm::CallInst *userMainCall;
     llvm::Function *howAreYou;
     std::shared_ptr<ast::ASTNode> root;
 
     llvm::LLVMContext theContext;
     std::unique_ptr<llvm::Module> mainModule;
+    std::unique_ptr<llvm::TargetMachine> targetMachine;
+    std::unique_ptr<llvm::DIBuilder> debugBuilder;
+    llvm::DIFile *debugFile = nullptr;
 
     std::vector<llvm::BasicBlock*> currentBlocks;
 
     std::vector<CompilerContext> compilerContextStack;
     std::map<std::string, std::shared_ptr<ast::Type>> typeTable;
     std::map<std::string, std::shared_ptr<ast::Type>> globalSymbolTable;
+    std::map<std::string, int> nvmVarIds;
+    std::vector<llvm::StructType*> typeDescriptorTypes;
 
     std::map<std::string, std::map<std::string, llvm::Value*>> functionStackVariables;
     std::unique_ptr<PersistentVarTaggingPass> pvarTag;
 
+    int regionDepth = 0;
+    std::vector<StackScope> stackScopes;
+    std::vector<LoopScope> loopScopes;
+    std::vector<llvm::Value*> gcRoots;
+    std::vector<llvm::Value*> rcArgs;
+    std::map<llvm::Function*, llvm::Value*> nvmBases;
+    unsigned currentLine = 0;
+    // line, function name
+    std::vector<std::pair<unsigned, std::string>> persistSites;
+    // --profile-generate counts [entry, true, false, true, false, ...] of each function
+    llvm::GlobalVariable *profileCounters = nullptr;
+    uint32_t nProfileCounters = 0;
+    // function name, first counter, number of branches
+    std::vector<std::tuple<std::string, uint32_t, uint32_t>> profiledFunctions;
+    std::map<std::string, ProfileFunction> profile;
+
     CompilerConfig config;
   };
 
@@ -0,0 +1,520 @@
+#include "jit.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Mangler.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace llvm;
+using namespace std;
+
+namespace {
+  al::TierUp *activeTierUp = nullptr;
+  std::vector<al::BackgroundCompiler*> activeCompilers;
+
+  std::string mangle(const std::string &name, const DataLayout &dataLayout) {
+    std::string mangledName;
+    raw_string_ostream mangledNameStream(mangledName);
+    Mangler::getNameWithPrefix(mangledNameStream, name, dataLayout);
+    return mangledNameStream.str();
+  }
+}
+
+// Called by tier 0 code when a function gets hot
+extern "C" void alTierUp(int32_t id) {
+  if (activeTierUp != nullptr) {
+    activeTierUp->request(id);
+  }
+}
+
+// AL__main_end exits the process from the program, the destructors never run then
+static void stopActiveCompilers() {
+  for (auto compiler : activeCompilers) {
+    compiler->stop();
+  }
+}
+
+al::JitObjectCache::JitObjectCache(std::string dir, const llvm::TargetMachine &targetMachine)
+    :dir(std::move(dir)),
+     targetKey(
+         targetMachine.getTargetTriple().str() + "/" +
+         targetMachine.getTargetCPU().str() + "/" +
+         targetMachine.getTargetFeatureString().str() + "/O" +
+         std::to_string((int)targetMachine.getOptLevel())
+     ) {
+  if (auto ec = sys::fs::create_directories(this->dir)) {
+    cerr << "cannot create JIT cache directory " << this->dir << ": " << ec.message() << endl;
+    abort();
+  }
+}
+
+std::string al::JitObjectCache::getPath(const llvm::Module *module) const {
+  SmallString<0> bitcode;
+  raw_svector_ostream bitcodeStream(bitcode);
+  WriteBitcodeToFile(module, bitcodeStream);
+
+  MD5 md5;
+  md5.update(targetKey);
+  md5.update(bitcode);
+  MD5::MD5Result result;
+  md5.final(result);
+  SmallString<32> hex;
+  MD5::stringifyResult(result, hex);
+  return dir + "/" + hex.str().str() + ".o";
+}
+
+void al::JitObjectCache::notifyObjectCompiled(const llvm::Module *module, llvm::MemoryBufferRef object) {
+  auto path = getPath(module);
+  // written next to the final name and renamed, concurrent runs never see half an object
+  auto tmpPath = path + ".tmp" + std::to_string(sys::Process::getProcessId());
+  std::error_code ec;
+  {
+    raw_fd_ostream out(tmpPath, ec, sys::fs::F_None);
+    if (ec) {
+      return;
+    }
+    out << object.getBuffer();
+  }
+  if (sys::fs::rename(tmpPath, path)) {
+    sys::fs::remove(tmpPath);
+  }
+}
+
+std::unique_ptr<llvm::MemoryBuffer> al::JitObjectCache::getObject(const llvm::Module *module) {
+  auto buffer = MemoryBuffer::getFile(getPath(module), -1, false);
+  if (!buffer) {
+    return nullptr;
+  }
+  return std::move(*buffer);
+}
+
+llvm::TargetMachine *al::createJitTargetMachine(const llvm::TargetMachine &target, llvm::CodeGenOpt::Level optLevel) {
+  SmallVector<std::string, 16> attrs;
+  SmallVector<StringRef, 16> features;
+  target.getTargetFeatureString().split(features, ',', -1, false);
+  for (auto feature : features) {
+    attrs.push_back(feature.str());
+  }
+  auto tm = EngineBuilder().setOptLevel(optLevel).selectTarget(target.getTargetTriple(), "", target.getTargetCPU(), attrs);
+  if (optLevel == CodeGenOpt::None) {
+    tm->setO0WantsFastISel(true);
+  }
+  return tm;
+}
+
+llvm::orc::RTDyldObjectLinkingLayer::NotifyLoadedFtor al::notifyListener(llvm::JITEventListener *listener) {
+  if (listener == nullptr) {
+    return orc::RTDyldObjectLinkingLayer::NotifyLoadedFtor();
+  }
+  // called before relocation like MCJIT's NotifyObjectEmitted, addresses are final already
+  return [listener](
+      orc::RTDyldObjectLinkingLayer::ObjHandleT,
+      const orc::RTDyldObjectLinkingLayer::ObjectPtr &obj,
+      const RuntimeDyld::LoadedObjectInfo &info
+  ) {
+    listener->NotifyObjectEmitted(*obj->getBinary(), info);
+  };
+}
+
+al::BackgroundCompiler::BackgroundCompiler(
+    const llvm::TargetMachine &target,
+    llvm::CodeGenOpt::Level optLevel,
+    SwapFn swap,
+    llvm::JITEventListener *listener
+)
+    :swap(std::move(swap)),
+     targetMachine(createJitTargetMachine(target, optLevel)),
+     objectLayer([]() { return std::make_shared<SectionMemoryManager>(); }, notifyListener(listener)),
+     compileLayer(objectLayer, orc::SimpleCompiler(*targetMachine)) {
+  static bool exitHookRegistered = false;
+  if (!exitHookRegistered) {
+    atexit(stopActiveCompilers);
+    exitHookRegistered = true;
+  }
+  activeCompilers.push_back(this);
+  thread = std::thread(&BackgroundCompiler::run, this);
+}
+
+al::BackgroundCompiler::~BackgroundCompiler() {
+  activeCompilers.erase(std::find(activeCompilers.begin(), activeCompilers.end(), this));
+  stop();
+}
+
+void al::BackgroundCompiler::setSource(llvm::Module &module) {
+  // the lazy JIT does this too, done first so the copies refer to locals by the same names
+  orc::makeAllSymbolsExternallyAccessible(module);
+  raw_svector_ostream bitcodeStream(bitcode);
+  WriteBitcodeToFile(&module, bitcodeStream);
+}
+
+void al::BackgroundCompiler::resolveSymbols(const std::function<llvm::JITTargetAddress(const std::string &name)> &resolve) {
+  LLVMContext c;
+  auto parsed = parseBitcodeFile(MemoryBufferRef(StringRef(bitcode.data(), bitcode.size()), "source"), c);
+  if (!parsed) {
+    logAllUnhandledErrors(parsed.takeError(), errs(), "cannot read background compiler bitcode: ");
+    abort();
+  }
+  for (auto &gv : (*parsed)->global_values()) {
+    if (!gv.isDeclaration() && gv.hasName()) {
+      symbols[mangle(gv.getName(), (*parsed)->getDataLayout())] = resolve(gv.getName());
+    }
+  }
+}
+
+void al::BackgroundCompiler::enqueue(const std::string &name) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(name);
+  }
+  queued.notify_one();
+}
+
+void al::BackgroundCompiler::waitIdle() {
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this]() { return stopping || (queue.empty() && !compiling); });
+}
+
+void al::BackgroundCompiler::stop() {
+  if (!thread.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  queued.notify_one();
+  idle.notify_all();
+  thread.join();
+}
+
+void al::BackgroundCompiler::run() {
+  while (true) {
+    std::string name;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      queued.wait(lock, [this]() { return stopping || !queue.empty(); });
+      if (stopping) {
+        return;
+      }
+      name = queue.front();
+      queue.pop_front();
+      compiling = true;
+    }
+    compile(name);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      compiling = false;
+    }
+    idle.notify_all();
+  }
+}
+
+void al::BackgroundCompiler::compile(const std::string &name) {
+  if (source == nullptr) {
+    auto parsed = parseBitcodeFile(MemoryBufferRef(StringRef(bitcode.data(), bitcode.size()), "source"), context);
+    if (!parsed) {
+      logAllUnhandledErrors(parsed.takeError(), errs(), "cannot read background compiler bitcode: ");
+      return;
+    }
+    source = std::move(*parsed);
+  }
+  // only the function and constants are defined, the rest resolves to the lazy JIT
+  ValueToValueMapTy vmap;
+  auto module = CloneModule(source.get(), vmap, [&name](const GlobalValue *gv) {
+    auto var = dyn_cast<GlobalVariable>(gv);
+    return gv->getName() == name || (var != nullptr && var->isConstant());
+  });
+  optimize(*module);
+
+  auto mangledName = mangle(name, module->getDataLayout());
+  auto resolver = orc::createLambdaResolver(
+      [this](const std::string &symbol) {
+        auto it = symbols.find(symbol);
+        if (it != symbols.end()) {
+          return JITSymbol(it->second, JITSymbolFlags::Exported);
+        }
+        return JITSymbol(nullptr);
+      },
+      [](const std::string &symbol) {
+        if (auto address = RTDyldMemoryManager::getSymbolAddressInProcess(symbol)) {
+          return JITSymbol(address, JITSymbolFlags::Exported);
+        }
+        return JITSymbol(nullptr);
+      }
+  );
+  auto handle = compileLayer.addModule(std::shared_ptr<Module>(std::move(module)), std::move(resolver));
+  if (!handle) {
+    logAllUnhandledErrors(handle.takeError(), errs(), "cannot add '" + name + "' to the background compiler: ");
+    return;
+  }
+  auto address = compileLayer.findSymbolIn(*handle, mangledName, false).getAddress();
+  if (!address) {
+    logAllUnhandledErrors(address.takeError(), errs(), "cannot compile '" + name + "' in the background: ");
+    return;
+  }
+  swap(name, *address);
+}
+
+al::TierUp::TierUp(
+    const llvm::TargetMachine &target,
+    unsigned optLevel,
+    uint32_t threshold,
+    SwapFn swap,
+    llvm::JITEventListener *listener
+)
+    :BackgroundCompiler(target, optLevel > 2 ? CodeGenOpt::Aggressive : CodeGenOpt::Default, std::move(swap), listener),
+     threshold(threshold),
+     optLevel(optLevel) {
+  activeTierUp = this;
+}
+
+al::TierUp::~TierUp() {
+  activeTierUp = nullptr;
+  // optimize() is not called on a half destroyed TierUp
+  stop();
+}
+
+void al::TierUp::instrument(llvm::Module &module) {
+  setSource(module);
+
+  auto &c = module.getContext();
+  auto i8 = Type::getInt8Ty(c);
+  auto i32 = Type::getInt32Ty(c);
+  auto tierUpFn = module.getOrInsertFunction("alTierUp", FunctionType::get(Type::getVoidTy(c), {i32}, false));
+  for (auto &f : module) {
+    // main and AL__main run once, there is no on-stack replacement to get their loops to tier 1
+    if (f.isDeclaration() || f.getName() == "main" || f.getName() == "AL__main") {
+      continue;
+    }
+    auto id = (int32_t)functions.size();
+    functions.push_back(f.getName());
+    auto counter = new GlobalVariable(
+        module, i32, false, GlobalValue::InternalLinkage, ConstantInt::get(i32, 0), "al.tier.count." + f.getName()
+    );
+    // set with the request, the counter keeps running and may wrap around
+    auto requested = new GlobalVariable(
+        module, i8, false, GlobalValue::InternalLinkage, ConstantInt::get(i8, 0), "al.tier.requested." + f.getName()
+    );
+
+    // the entry, after the allocas, and the end of every block branching back to a dominator
+    std::vector<Instruction*> sites;
+    auto entry = f.getEntryBlock().begin();
+    while (isa<AllocaInst>(entry)) {
+      ++entry;
+    }
+    sites.push_back(&*entry);
+    DominatorTree dt(f);
+    for (auto &bb : f) {
+      for (auto succ : successors(&bb)) {
+        if (dt.dominates(succ, &bb)) {
+          sites.push_back(bb.getTerminator());
+          break;
+        }
+      }
+    }
+
+    for (auto site : sites) {
+      IRBuilder<> builder(site);
+      auto count = builder.CreateAdd(builder.CreateLoad(counter), ConstantInt::get(i32, 1));
+      builder.CreateStore(count, counter);
+      auto hot = builder.CreateICmpUGE(count, ConstantInt::get(i32, threshold));
+      IRBuilder<> hotBuilder(SplitBlockAndInsertIfThen(hot, site, false));
+      auto first = hotBuilder.CreateICmpEQ(hotBuilder.CreateLoad(requested), ConstantInt::get(i8, 0));
+      IRBuilder<> requestBuilder(SplitBlockAndInsertIfThen(first, &*hotBuilder.GetInsertPoint(), false));
+      requestBuilder.CreateStore(ConstantInt::get(i8, 1), requested);
+      requestBuilder.CreateCall(tierUpFn, {ConstantInt::get(i32, id)});
+    }
+  }
+}
+
+void al::TierUp::request(int32_t id) {
+  enqueue(functions[id]);
+}
+
+void al::TierUp::optimize(llvm::Module &module) {
+  PassManagerBuilder builder;
+  builder.OptLevel = optLevel;
+  builder.Inliner = createFunctionInliningPass(optLevel, 0, false);
+  builder.LoopVectorize = optLevel > 1;
+  builder.SLPVectorize = optLevel > 1;
+  legacy::FunctionPassManager functionPasses(&module);
+  legacy::PassManager modulePasses;
+  functionPasses.add(createTargetTransformInfoWrapperPass(getTargetMachine().getTargetIRAnalysis()));
+  modulePasses.add(createTargetTransformInfoWrapperPass(getTargetMachine().getTargetIRAnalysis()));
+  builder.populateFunctionPassManager(functionPasses);
+  builder.populateModulePassManager(modulePasses);
+  functionPasses.doInitialization();
+  for (auto &f : module) {
+    functionPasses.run(f);
+  }
+  functionPasses.doFinalization();
+  modulePasses.run(module);
+}
+
+std::vector<std::string> al::reachableFunctions(const llvm::Module &module) {
+  std::vector<const Function*> order;
+  std::set<const Function*> seen;
+  std::function<void(const Value*)> visit = [&](const Value *v) {
+    if (auto f = dyn_cast<Function>(v)) {
+      if (!f->isDeclaration() && seen.insert(f).second) {
+        order.push_back(f);
+      }
+    } else if (isa<Constant>(v) && !isa<GlobalValue>(v)) {
+      // constant expressions and aggregates, e.g. a function cast to another type
+      for (auto &op : cast<Constant>(v)->operands()) {
+        visit(op);
+      }
+    }
+  };
+  auto main = module.getFunction("main");
+  if (main == nullptr) {
+    return {};
+  }
+  visit(main);
+  // breadth first, callees and functions whose address is taken alike
+  for (size_t i = 0; i < order.size(); ++i) {
+    for (auto &inst : instructions(order[i])) {
+      for (auto &op : inst.operands()) {
+        visit(op);
+      }
+    }
+  }
+
+  std::vector<std::string> names;
+  // main is compiled by its first call right away
+  for (size_t i = 1; i < order.size(); ++i) {
+    names.push_back(order[i]->getName());
+  }
+  return names;
+}
+
+al::Jit::Jit(const CompilerConfig &config, const llvm::TargetMachine &target)
+    :enableSpeculativeJit(config.enableSpeculativeJit),
+     targetMachine(createJitTargetMachine(target, config.enableTieredJit ? CodeGenOpt::None : CodeGenOpt::Default)),
+     dataLayout(targetMachine->createDataLayout()),
+     objectCache(config.jitCacheDir.empty() ? nullptr : new JitObjectCache(config.jitCacheDir, *targetMachine)),
+     perfListener(
+         config.enablePerfMap || config.enableJitdump
+         ? new PerfJitEventListener(config.enablePerfMap, config.enableJitdump)
+         : nullptr
+     ),
+     objectLayer([]() { return std::make_shared<SectionMemoryManager>(); }, notifyListener(perfListener.get())),
+     compileLayer(objectLayer, orc::SimpleCompiler(*targetMachine, objectCache.get())),
+     compileCallbackManager(orc::createLocalCompileCallbackManager(targetMachine->getTargetTriple(), 0)),
+     codLayer(
+         compileLayer,
+         // one partition per function
+         [](Function &f) { return std::set<Function*>({&f}); },
+         *compileCallbackManager,
+         orc::createLocalIndirectStubsManagerBuilder(targetMachine->getTargetTriple())
+     ) {
+  // the runtime is linked into ali, make its symbols visible to the resolver
+  sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+  if (config.enableTieredJit) {
+    tierUp.reset(new TierUp(
+        target,
+        config.tierUpOptLevel,
+        config.tierUpThreshold,
+        [this](const std::string &name, JITTargetAddress address) { swapStub(name, address); },
+        perfListener.get()
+    ));
+  }
+}
+
+// The stub's pointer is one aligned word, calls see either the old or the new code
+void al::Jit::swapStub(const std::string &name, llvm::JITTargetAddress address) {
+  if (auto err = codLayer.updatePointer(name, address)) {
+    logAllUnhandledErrors(std::move(err), errs(), "cannot swap in '" + name + "': ");
+  }
+}
+
+void al::Jit::addModule(std::unique_ptr<llvm::Module> module) {
+  if (module->getDataLayout().isDefault()) {
+    module->setDataLayout(dataLayout);
+  }
+  if (tierUp) {
+    tierUp->instrument(*module);
+  }
+  threaded = module->getFunction("thread") != nullptr;
+  // speculated tier 0 code must not replace tier 1 code, with the tiered JIT only
+  // programs calling thread() speculate, and they are done before main runs
+  std::vector<std::string> speculated;
+  if (threaded || (enableSpeculativeJit && !tierUp)) {
+    speculator.reset(new BackgroundCompiler(
+        *targetMachine,
+        targetMachine->getOptLevel(),
+        [this](const std::string &name, JITTargetAddress address) { swapStub(name, address); },
+        perfListener.get()
+    ));
+    speculator->setSource(*module);
+    speculated = reachableFunctions(*module);
+  }
+  auto resolver = orc::createLambdaResolver(
+      [this](const std::string &name) {
+        if (auto symbol = codLayer.findSymbol(name, false)) {
+          return symbol;
+        }
+        return JITSymbol(nullptr);
+      },
+      [](const std::string &name) {
+        if (auto address = RTDyldMemoryManager::getSymbolAddressInProcess(name)) {
+          return JITSymbol(address, JITSymbolFlags::Exported);
+        }
+        return JITSymbol(nullptr);
+      }
+  );
+  auto handle = codLayer.addModule(std::shared_ptr<Module>(std::move(module)), std::move(resolver));
+  if (!handle) {
+    logAllUnhandledErrors(handle.takeError(), errs(), "cannot add module to the JIT: ");
+    abort();
+  }
+  if (tierUp) {
+    tierUp->resolveSymbols([this](const std::string &name) { return getSymbolAddress(name); });
+  }
+  if (speculator) {
+    speculator->resolveSymbols([this](const std::string &name) { return getSymbolAddress(name); });
+    for (auto &name : speculated) {
+      speculator->enqueue(name);
+    }
+  }
+}
+
+llvm::JITTargetAddress al::Jit::getSymbolAddress(const std::string &name) {
+  auto symbol = codLayer.findSymbol(mangle(name, dataLayout), false);
+  if (!symbol) {
+    cerr << "symbol not found in the JIT '" << name << "'" << endl;
+    abort();
+  }
+  auto address = symbol.getAddress();
+  if (!address) {
+    logAllUnhandledErrors(address.takeError(), errs(), "cannot compile '" + name + "': ");
+    abort();
+  }
+  return *address;
+}
+
+int al::Jit::runMain() {
+  // every function the threads may call is compiled, none of them reaches a lazy stub
+  if (threaded) {
+    speculator->waitIdle();
+  }
+  auto main = (int (*)())getSymbolAddress("main");
+  return main();
+}
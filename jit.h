@@ -0,0 +1,199 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LambdaResolver.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Target/TargetMachine.h"
+#include "compile_time.h"
+#include "perf_map.h"
+
+namespace al {
+  // A machine for the JITs with the triple, CPU and features of `target`, the one the module was generated for
+  llvm::TargetMachine *createJitTargetMachine(
+      const llvm::TargetMachine &target,
+      llvm::CodeGenOpt::Level optLevel = llvm::CodeGenOpt::Default
+  );
+
+  /**
+   * On-disk object cache (--jit-cache-dir <dir>)
+   * Objects are stored as <dir>/<md5>.o, the md5 is taken over the module's bitcode and
+   * the target triple, CPU and features, so a changed program or machine misses.
+   */
+  class JitObjectCache :public llvm::ObjectCache {
+  public:
+    JitObjectCache(std::string dir, const llvm::TargetMachine &targetMachine);
+    void notifyObjectCompiled(const llvm::Module *module, llvm::MemoryBufferRef object) override;
+    std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *module) override;
+  private:
+    std::string getPath(const llvm::Module *module) const;
+
+    std::string dir;
+    std::string targetKey;
+  };
+
+  // Object layer telling listener about every object it loads, listener may be null
+  llvm::orc::RTDyldObjectLinkingLayer::NotifyLoadedFtor notifyListener(llvm::JITEventListener *listener);
+
+  /**
+   * Compiles functions of the lazy JIT's module on a background thread and passes their
+   * addresses to `swap`, which points the functions' stubs at them. Every function is
+   * cloned out of a bitcode copy of the module into a private LLVMContext, its calls and
+   * globals resolve to the lazy JIT's stubs and globals.
+   */
+  class BackgroundCompiler {
+  public:
+    using SwapFn = std::function<void(const std::string &name, llvm::JITTargetAddress address)>;
+
+    // listener may be null, it is told about every object
+    BackgroundCompiler(
+        const llvm::TargetMachine &target,
+        llvm::CodeGenOpt::Level optLevel,
+        SwapFn swap,
+        llvm::JITEventListener *listener
+    );
+    virtual ~BackgroundCompiler();
+
+    // Keeps a copy of the module to compile from, before it is added to the lazy JIT
+    void setSource(llvm::Module &module);
+    // `resolve` looks up the lazy JIT's symbols, it is called for each before the program starts
+    void resolveSymbols(const std::function<llvm::JITTargetAddress(const std::string &name)> &resolve);
+    void enqueue(const std::string &name);
+    // Returns once the queue is empty and no function is being compiled
+    void waitIdle();
+    // Waits for the function being compiled and joins the thread, called again it does nothing
+    void stop();
+
+  protected:
+    // Run on the module of each function before code generation
+    virtual void optimize(llvm::Module &module) {}
+    llvm::TargetMachine &getTargetMachine() { return *targetMachine; }
+
+  private:
+    void run();
+    void compile(const std::string &name);
+
+    SwapFn swap;
+    std::unique_ptr<llvm::TargetMachine> targetMachine;
+    llvm::SmallVector<char, 0> bitcode;
+    std::map<std::string, llvm::JITTargetAddress> symbols;
+
+    // only touched by the background thread
+    llvm::LLVMContext context;
+    std::unique_ptr<llvm::Module> source;
+    llvm::orc::RTDyldObjectLinkingLayer objectLayer;
+    llvm::orc::IRCompileLayer<llvm::orc::RTDyldObjectLinkingLayer, llvm::orc::SimpleCompiler> compileLayer;
+
+    // guards queue, compiling and stopping
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable idle;
+    std::deque<std::string> queue;
+    bool compiling = false;
+    bool stopping = false;
+    std::thread thread;
+  };
+
+  /**
+   * Tier 1 of the tiered JIT (--enable-tiered-jit)
+   * instrument() gives every function a counter bumped on entry and on loop back edges,
+   * the first call reaching --tier-up-threshold asks for the function with alTierUp(id).
+   * The background thread then optimizes the uninstrumented copy of the function at
+   * --tier-up-opt-level and swaps it in. Frames already running the tier 0 code finish
+   * there, there is no on-stack replacement.
+   */
+  class TierUp :public BackgroundCompiler {
+  public:
+    TierUp(
+        const llvm::TargetMachine &target,
+        unsigned optLevel,
+        uint32_t threshold,
+        SwapFn swap,
+        llvm::JITEventListener *listener
+    );
+    ~TierUp() override;
+
+    // Run on the module before it is added to the tier 0 JIT
+    void instrument(llvm::Module &module);
+    // Called by the program through alTierUp, queues the function for tier 1
+    void request(int32_t id);
+
+  protected:
+    void optimize(llvm::Module &module) override;
+
+  private:
+    uint32_t threshold;
+    unsigned optLevel;
+    std::vector<std::string> functions;
+  };
+
+  /**
+   * Speculative compilation (--enable-speculative-jit, on by default)
+   * The functions reachable from main are queued nearest first, in a breadth first walk
+   * of the call graph where taking a function's address counts as calling it, so most
+   * stubs point at code before their first call. Programs calling `thread()` wait for
+   * all of them before main runs, the lazy stubs of ORC are not thread safe and are
+   * never taken then.
+   */
+  std::vector<std::string> reachableFunctions(const llvm::Module &module);
+
+  /**
+   * Lazy JIT of ali (--enable-lazy-jit, on by default)
+   * Every function of the module is split into its own partition behind a stub, a
+   * partition is compiled the first time its stub is called, so functions that never
+   * run are never compiled. External symbols resolve to the runtime linked into ali.
+   */
+  class Jit {
+  public:
+    using CompileLayer = llvm::orc::IRCompileLayer<llvm::orc::RTDyldObjectLinkingLayer, llvm::orc::SimpleCompiler>;
+    using CodLayer = llvm::orc::CompileOnDemandLayer<CompileLayer>;
+
+    // Objects are cached in config.jitCacheDir if it is set. With config.enableTieredJit
+    // functions are compiled without optimization first and hot ones again by TierUp.
+    // With config.enableSpeculativeJit the callees of main are compiled ahead.
+    Jit(const CompilerConfig &config, const llvm::TargetMachine &target);
+
+    llvm::TargetMachine &getTargetMachine() { return *targetMachine; }
+    void addModule(std::unique_ptr<llvm::Module> module);
+    llvm::JITTargetAddress getSymbolAddress(const std::string &name);
+    // Runs `int main()` of the added modules
+    int runMain();
+
+  private:
+    void swapStub(const std::string &name, llvm::JITTargetAddress address);
+
+    bool enableSpeculativeJit;
+    // set by addModule for programs calling thread()
+    bool threaded = false;
+    std::unique_ptr<llvm::TargetMachine> targetMachine;
+    const llvm::DataLayout dataLayout;
+    std::unique_ptr<JitObjectCache> objectCache;
+    // --enable-perf-map, --enable-jitdump
+    std::unique_ptr<PerfJitEventListener> perfListener;
+    llvm::orc::RTDyldObjectLinkingLayer objectLayer;
+    CompileLayer compileLayer;
+    std::unique_ptr<llvm::orc::JITCompileCallbackManager> compileCallbackManager;
+    CodLayer codLayer;
+    // last, their threads are stopped before the layers they swap stubs in go away
+    std::unique_ptr<TierUp> tierUp;
+    std::unique_ptr<BackgroundCompiler> speculator;
+  };
+}
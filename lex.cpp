@@ -3,6 +3,7 @@
 //
 
 #include "lex.h"
+#include <algorithm>
 #include <tuple>
 
 bool al::Lexer::parseQuoteString(std::string &str, std::string eos) {
@@ -51,6 +52,12 @@ al::Parser::symbol_type al::Lexer::lex() {
             return Parser::make_INEQ(Parser::location_type());
           }
       },
+      {
+          "\\=\\=",
+          [](const std::string &s) -> Parser::symbol_type {
+            return Parser::make_EQEQ(Parser::location_type());
+          }
+      },
       {
           "\\(",
           [](const std::string &s) -> Parser::symbol_type {
@@ -134,6 +141,18 @@ al::Parser::symbol_type al::Lexer::lex() {
             return Parser::make_PLUS(Parser::location_type());
           }
       },
+      {
+          "\\-",
+          [](const std::string &s) -> Parser::symbol_type {
+            return Parser::make_MINUS(Parser::location_type());
+          }
+      },
+      {
+          "\\%",
+          [](const std::string &s) -> Parser::symbol_type {
+            return Parser::make_PERCENT(Parser::location_type());
+          }
+      },
       {
           "\\<",
           [](const std::string &s) -> Parser::symbol_type {
@@ -219,6 +238,19 @@ al::Parser::symbol_type al::Lexer::lex() {
             return Parser::make_PERSISTENT(Parser::location_type());
           }
       },
+      {
+          // names such as rcount are symbols
+          "rc\\b",
+          [](const std::string &s) -> Parser::symbol_type {
+            return Parser::make_RC(Parser::location_type());
+          }
+      },
+      {
+          "region\\b",
+          [](const std::string &s) -> Parser::symbol_type {
+            return Parser::make_REGION(Parser::location_type());
+          }
+      },
       {
           "return",
           [](const std::string &s) -> Parser::symbol_type {
@@ -237,6 +269,12 @@ al::Parser::symbol_type al::Lexer::lex() {
             return Parser::make_STRUCT(Parser::location_type());
           }
       },
+      {
+          "typeid\\b",
+          [](const std::string &s) -> Parser::symbol_type {
+            return Parser::make_TYPEID(Parser::location_type());
+          }
+      },
       {
           "volatile",
           [](const std::string &s) -> Parser::symbol_type {
@@ -272,9 +310,14 @@ al::Parser::symbol_type al::Lexer::lex() {
 
     RE2 re("((?m:" + reg + "))");
     if (RE2::Consume(&input, re, &var)) {
+      auto tokenLine = line;
+      line += std::count(var.begin(), var.end(), '\n');
       // FIXME: i == 0 for blank characters, i == 1 for comments
-      if (i >= 2)
-        return fn(var);
+      if (i >= 2) {
+        auto symbol = fn(var);
+        symbol.location.begin.line = symbol.location.end.line = tokenLine;
+        return symbol;
+      }
     }
     i++;
   }
@@ -38,6 +38,8 @@ namespace al {
   private:
     std::string s;
     re2::StringPiece input;
+    // line of the next unconsumed character, starting at 1
+    unsigned line = 1;
   };
 
 
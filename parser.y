@@ -45,16 +45,16 @@
 %define parse.trace
 %define parse.error verbose
 
-%token FN FOR IF ELSE STRUCT PERSISTENT EXTERN VOLATILE SIZEOF RETURN BREAK
+%token FN FOR IF ELSE STRUCT PERSISTENT EXTERN VOLATILE SIZEOF TYPEID RETURN BREAK REGION RC
 %token SEMICOLON ";";
 %token COLON COMMA BANG AT OP_MOVE
 %token QUOTE "'";
 %right RIGHT_ARROW
-%right EQ INEQ
+%right EQ INEQ EQEQ
 %left LT GT
 %left AND
-%left PLUS
-%left STAR
+%left PLUS MINUS
+%left STAR PERCENT
 %left DOT
 %token LEFTBRACKET RIGHTBRACKET
 %token LEFTBRACE RIGHTBRACE
@@ -92,6 +92,7 @@
 %type< std::shared_ptr<al::ast::Literal> > exp_lit;
 %type< std::shared_ptr<al::ast::ArrayLiteral> > exp_array_lit;
 %type< std::shared_ptr<al::ast::ExpSizeOf> > exp_size_of;
+%type< std::shared_ptr<al::ast::ExpTypeId> > exp_type_id;
 %type< std::shared_ptr<al::ast::ExpDeref> > exp_deref;
 %type< std::shared_ptr<al::ast::ExpGetAddr> > exp_get_addr;
 %type< std::shared_ptr<al::ast::ExpReturn> > exp_return;
@@ -99,6 +100,7 @@
 %type< std::shared_ptr<al::ast::ExpVolatileCast> > exp_volatile_cast;
 %type< std::shared_ptr<al::ast::ExpFor> > exp_for;
 %type< std::shared_ptr<al::ast::ExpIf> > exp_if;
+%type< std::shared_ptr<al::ast::ExpRegion> > exp_region;
 
 %type< std::shared_ptr<al::ast::Type> > type;
 %type< std::shared_ptr<al::ast::Annotation> > annotation;
@@ -162,6 +164,7 @@ fn_decl: FN SYMBOL_LIT LEFTPAR fn_args RIGHTPAR {
     | FN SYMBOL_LIT LEFTPAR RIGHTPAR type { $$ = std::make_shared<al::ast::FnDecl>($2, $5); }
 fn_block: fn_decl stmt_block {
         $$ = std::make_shared<al::ast::FnDef>($1, $2);
+        $$->setLine(@1.begin.line);
     }
 
 /* stmt_block
@@ -172,7 +175,12 @@ stmt_block: LEFTBRACE stmts RIGHTBRACE {
     }
 stmts: { $$ = std::make_shared<al::ast::Stmts>(); }
     | stmt stmts { $$ = $2; $$->prependChild($1); }
-stmt: exp SEMICOLON { $$ = $1; }
+stmt: exp SEMICOLON {
+        $$ = $1;
+        if ($$->getLine() == 0) {
+          $$->setLine(@1.begin.line);
+        }
+    }
 
 /**
  * exp
@@ -188,6 +196,7 @@ exp:  exp_call { $$ = $1; }
     | exp_array_index { $$ = $1; }
     | exp_lit { $$ = $1; }
     | exp_size_of { $$ = $1; }
+    | exp_type_id { $$ = $1; }
     | exp_get_addr { $$ = $1; }
     | exp_deref { $$ = $1; }
     | exp_return { $$ = $1; }
@@ -196,6 +205,7 @@ exp:  exp_call { $$ = $1; }
     | exp_volatile_cast { $$ = $1; }
     | exp_for { $$ = $1; }
     | exp_if { $$ = $1; }
+    | exp_region { $$ = $1; }
 
 exp_call: SYMBOL_LIT LEFTPAR exps RIGHTPAR {
       $$ = std::make_shared<al::ast::ExpCall>($1, $3->toVector());
@@ -206,9 +216,18 @@ exp_call: SYMBOL_LIT LEFTPAR exps RIGHTPAR {
 exp_op: exp PLUS exp {
         $$ = std::make_shared<al::ast::ExpCall>("+", std::vector<std::shared_ptr<al::ast::Exp>>({$1, $3}));
       }
+    | exp MINUS exp {
+        $$ = std::make_shared<al::ast::ExpCall>("-", std::vector<std::shared_ptr<al::ast::Exp>>({$1, $3}));
+      }
+    | exp PERCENT exp {
+        $$ = std::make_shared<al::ast::ExpCall>("%", std::vector<std::shared_ptr<al::ast::Exp>>({$1, $3}));
+      }
     | exp INEQ exp {
         $$ = std::make_shared<al::ast::ExpCall>("!=", std::vector<std::shared_ptr<al::ast::Exp>>({$1, $3}));
       }
+    | exp EQEQ exp {
+        $$ = std::make_shared<al::ast::ExpCall>("==", std::vector<std::shared_ptr<al::ast::Exp>>({$1, $3}));
+      }
     | exp LT exp {
         $$ = std::make_shared<al::ast::ExpCall>("<", std::vector<std::shared_ptr<al::ast::Exp>>({$1, $3}));
       }
@@ -218,12 +237,19 @@ exp_op: exp PLUS exp {
     | exp LT LT exp {
         $$ = std::make_shared<al::ast::ExpCall>("<<", std::vector<std::shared_ptr<al::ast::Exp>>({$1, $4}));
       }
-exp_assign: exp EQ exp { $$ = std::make_shared<al::ast::ExpAssign>($1, $3); }
+exp_assign: exp EQ exp {
+    $$ = std::make_shared<al::ast::ExpAssign>($1, $3);
+    $$->setLine(@2.begin.line);
+  }
 exp_move: exp_var_ref OP_MOVE exp_var_ref { $$ = std::make_shared<al::ast::ExpMove>($1, $3); }
 
 exp_var_ref: SYMBOL_LIT { $$ = std::make_shared<al::ast::ExpVarRef>($1); }
-exp_var_def: var_decl EQ exp { $$ = std::make_shared<al::ast::ExpStackVarDef>($1, $3); }
+exp_var_def: var_decl EQ exp {
+    $$ = std::make_shared<al::ast::ExpStackVarDef>($1, $3);
+    $$->setLine(@2.begin.line);
+  }
 exp_size_of: SIZEOF LEFTPAR type RIGHTPAR { $$ = std::make_shared<al::ast::ExpSizeOf>($3); }
+exp_type_id: TYPEID LEFTPAR type RIGHTPAR { $$ = std::make_shared<al::ast::ExpTypeId>($3); }
 exp_member: exp DOT SYMBOL_LIT { $$ = std::make_shared<al::ast::ExpMemberAccess>($1, $3); }
 exp_lit: INT_LIT { $$ = $1; }
     | exp_array_lit { $$ = $1; }
@@ -248,6 +274,12 @@ exp_for: FOR exp SEMICOLON exp SEMICOLON exp stmt_block {
 exp_if: IF exp stmt_block ELSE stmt_block { $$ = std::make_shared<ast::ExpIf>($2, $3, $5); }
     | IF exp stmt_block { $$ = std::make_shared<ast::ExpIf>($2, $3); }
 
+/* exp_region
+ * region { n: *Node = vAlloc(sizeof(Node)); }
+ * Everything allocated in the block is freed when leaving it.
+ */
+exp_region: REGION stmt_block { $$ = std::make_shared<ast::ExpRegion>($2); }
+
 exps: exp { $$ = std::make_shared<al::ast::ExpList>(); $$->prependChild($1); }
     | exp COMMA exps { $$ = $3; $$->prependChild($1); }
 
@@ -263,6 +295,7 @@ type: SYMBOL_LIT { $$ = std::make_shared<al::ast::Type>($1); }
     | STAR type { $$ = std::make_shared<al::ast::Type>($2, al::ast::Type::Ptr); }
     | LEFTBRACKET exp RIGHTBRACKET type { $$ = std::make_shared<al::ast::Type>($4, al::ast::Type::Array, $2); }
     | PERSISTENT type { $$ = std::make_shared<al::ast::Type>($2, al::ast::Type::Persistent); }
+    | RC LT type GT { $$ = std::make_shared<al::ast::Type>($3, al::ast::Type::Rc); }
     | FN LEFTPAR fn_args RIGHTPAR { $$ = std::make_shared<al::ast::Type>($3); }
     | FN LEFTPAR RIGHTPAR {
         $$ = std::make_shared<al::ast::Type>(std::make_shared<al::ast::VarDecls>());
@@ -0,0 +1,221 @@
+#include "perf_map.h"
+#include <cinttypes>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <vector>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "llvm/DebugInfo/DIContext.h"
+#include "llvm/DebugInfo/DWARF/DWARFContext.h"
+#include "llvm/Object/SymbolSize.h"
+
+using namespace llvm;
+using namespace std;
+
+namespace {
+  /**
+   * jitdump format, see tools/perf/Documentation/jitdump-specification.txt of Linux
+   * A file header, then records, each starting with JitdumpRecordHeader.
+   * The debug info of a function precedes its code load record.
+   */
+  const uint32_t JitdumpMagic = 0x4A695444;
+  const uint32_t JitdumpVersion = 1;
+  const uint32_t JitCodeLoad = 0;
+  const uint32_t JitCodeDebugInfo = 2;
+
+  struct JitdumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t totalSize;
+    uint32_t elfMach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+  };
+
+  struct JitdumpRecordHeader {
+    uint32_t id;
+    uint32_t totalSize;
+    uint64_t timestamp;
+  };
+
+  // followed by the name, 0 terminated, and the code
+  struct JitdumpCodeLoad {
+    JitdumpRecordHeader header;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t codeAddr;
+    uint64_t codeSize;
+    uint64_t codeIndex;
+  };
+
+  // followed by nEntries {uint64_t addr; uint32_t line; uint32_t discrim; char file[];}
+  struct JitdumpDebugInfo {
+    JitdumpRecordHeader header;
+    uint64_t codeAddr;
+    uint64_t nEntries;
+  };
+
+  // perf record -k mono samples CLOCK_MONOTONIC
+  uint64_t timestamp() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+
+  template<typename T>
+  void append(std::vector<char> &buffer, const T &value) {
+    auto p = (const char*)&value;
+    buffer.insert(buffer.end(), p, p + sizeof(T));
+  }
+
+  void appendString(std::vector<char> &buffer, const std::string &s) {
+    buffer.insert(buffer.end(), s.begin(), s.end());
+    buffer.push_back('\0');
+  }
+}
+
+al::PerfJitEventListener::PerfJitEventListener(bool perfMap, bool jitdump) {
+  if (perfMap) {
+    auto path = "/tmp/perf-" + to_string(getpid()) + ".map";
+    mapFile = fopen(path.c_str(), "w");
+    if (mapFile == nullptr) {
+      cerr << "cannot write perf map " << path << endl;
+    }
+  }
+  if (jitdump) {
+    openJitdump();
+  }
+}
+
+al::PerfJitEventListener::~PerfJitEventListener() {
+  if (mapFile != nullptr) {
+    fclose(mapFile);
+  }
+  if (dumpFile != nullptr) {
+    munmap(dumpMarker, dumpMarkerSize);
+    fclose(dumpFile);
+  }
+}
+
+void al::PerfJitEventListener::openJitdump() {
+  auto dir = getenv("JITDUMPDIR");
+  auto path = string(dir != nullptr && *dir ? dir : "/tmp") + "/jit-" + to_string(getpid()) + ".dump";
+  dumpFile = fopen(path.c_str(), "w+");
+  if (dumpFile == nullptr) {
+    cerr << "cannot write jitdump " << path << endl;
+    return;
+  }
+  dumpMarkerSize = (size_t)sysconf(_SC_PAGESIZE);
+  dumpMarker = mmap(nullptr, dumpMarkerSize, PROT_READ | PROT_EXEC, MAP_PRIVATE, fileno(dumpFile), 0);
+  if (dumpMarker == MAP_FAILED) {
+    cerr << "cannot map jitdump " << path << ", perf will not find it" << endl;
+    fclose(dumpFile);
+    dumpFile = nullptr;
+    return;
+  }
+
+  JitdumpHeader header = {};
+  header.magic = JitdumpMagic;
+  header.version = JitdumpVersion;
+  header.totalSize = sizeof(header);
+#if defined(__x86_64__)
+  header.elfMach = EM_X86_64;
+#elif defined(__aarch64__)
+  header.elfMach = EM_AARCH64;
+#endif
+  header.pid = (uint32_t)getpid();
+  header.timestamp = timestamp();
+  writeJitdump(&header, sizeof(header));
+}
+
+void al::PerfJitEventListener::writeJitdump(const void *record, size_t size) {
+  fwrite(record, 1, size, dumpFile);
+  fflush(dumpFile);
+}
+
+void al::PerfJitEventListener::NotifyObjectEmitted(const object::ObjectFile &obj, const RuntimeDyld::LoadedObjectInfo &info) {
+  // the object for debug has its sections at the addresses they were loaded to
+  auto debugObjOwner = info.getObjectForDebug(obj);
+  auto &debugObj = *debugObjOwner.getBinary();
+  std::unique_ptr<DIContext> dwarf;
+  if (dumpFile != nullptr) {
+    dwarf.reset(new DWARFContextInMemory(debugObj));
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto &symbolSize : object::computeSymbolSizes(debugObj)) {
+    auto symbol = symbolSize.first;
+    auto type = symbol.getType();
+    if (!type) {
+      consumeError(type.takeError());
+      continue;
+    }
+    auto name = symbol.getName();
+    if (!name) {
+      consumeError(name.takeError());
+      continue;
+    }
+    auto address = symbol.getAddress();
+    if (!address) {
+      consumeError(address.takeError());
+      continue;
+    }
+    auto size = symbolSize.second;
+    if (*type != object::SymbolRef::ST_Function || size == 0) {
+      continue;
+    }
+
+    if (mapFile != nullptr) {
+      fprintf(mapFile, "%" PRIx64 " %" PRIx64 " %s\n", *address, size, name->str().c_str());
+      fflush(mapFile);
+    }
+    if (dumpFile == nullptr) {
+      continue;
+    }
+
+    auto lines = dwarf->getLineInfoForAddressRange(*address, size, DILineInfoSpecifier(
+        DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath,
+        DILineInfoSpecifier::FunctionNameKind::None
+    ));
+    if (!lines.empty()) {
+      std::vector<char> record;
+      JitdumpDebugInfo debugInfo = {};
+      debugInfo.header.id = JitCodeDebugInfo;
+      debugInfo.header.timestamp = timestamp();
+      debugInfo.codeAddr = *address;
+      debugInfo.nEntries = lines.size();
+      append(record, debugInfo);
+      for (auto &line : lines) {
+        append(record, (uint64_t)line.first);
+        append(record, (uint32_t)line.second.Line);
+        append(record, (uint32_t)0);
+        appendString(record, line.second.FileName);
+      }
+      ((JitdumpDebugInfo*)record.data())->header.totalSize = (uint32_t)record.size();
+      writeJitdump(record.data(), record.size());
+    }
+
+    std::vector<char> record;
+    JitdumpCodeLoad codeLoad = {};
+    codeLoad.header.id = JitCodeLoad;
+    codeLoad.header.timestamp = timestamp();
+    codeLoad.pid = (uint32_t)getpid();
+    codeLoad.tid = (uint32_t)syscall(SYS_gettid);
+    codeLoad.vma = *address;
+    codeLoad.codeAddr = *address;
+    codeLoad.codeSize = size;
+    codeLoad.codeIndex = codeIndex++;
+    append(record, codeLoad);
+    appendString(record, *name);
+    auto code = (const char*)*address;
+    record.insert(record.end(), code, code + size);
+    ((JitdumpCodeLoad*)record.data())->header.totalSize = (uint32_t)record.size();
+    writeJitdump(record.data(), record.size());
+  }
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/RuntimeDyld.h"
+#include "llvm/Object/ObjectFile.h"
+
+namespace al {
+  /**
+   * Makes JIT compiled code visible to Linux perf
+   * --enable-perf-map writes /tmp/perf-<pid>.map, one "<address> <size> <name>" line per
+   * function, perf report reads it by itself.
+   * --enable-jitdump writes jit-<pid>.dump ($JITDUMPDIR or /tmp) with the code and the .al
+   * lines of every function, for perf annotate:
+   *   perf record -k mono ali --enable-jitdump 1 app.al
+   *   perf inject --jit -i perf.data -o perf.jit.data && perf report -i perf.jit.data
+   */
+  class PerfJitEventListener :public llvm::JITEventListener {
+  public:
+    PerfJitEventListener(bool perfMap, bool jitdump);
+    ~PerfJitEventListener() override;
+    void NotifyObjectEmitted(const llvm::object::ObjectFile &obj, const llvm::RuntimeDyld::LoadedObjectInfo &info) override;
+
+  private:
+    void openJitdump();
+    void writeJitdump(const void *record, size_t size);
+
+    FILE *mapFile = nullptr;
+    FILE *dumpFile = nullptr;
+    // perf finds the dump by this executable mapping of it
+    void *dumpMarker = nullptr;
+    size_t dumpMarkerSize = 0;
+    uint64_t codeIndex = 0;
+    // ali's JITs emit from the program's thread and the tier up thread
+    std::mutex mutex;
+  };
+}
@@ -2,6 +2,7 @@
 #include <cctype>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <map>
 #include <memory>
 #include <string>
@@ -9,9 +10,18 @@
 #include <iostream>
 #include <sstream>
 #include <chrono>
+#include <deque>
 
-#include "../nvm_malloc/src/nvm_malloc.h"
+#include "nvm_backend.h"
+#include "numa.h"
+#include "trace.h"
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <csignal>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
 
 using namespace std;
 
@@ -33,28 +43,832 @@ std::map<std::thread::id, std::string> *threadNames;
 // thread, relptr, length
 std::map<std::tuple<string, void*, uint64_t>, string> nvmVarMap;
 
+/**
+ * Volatile regions, a bump allocator per `region {}` block.
+ * Chunks are recycled through a thread local free list, so entering and leaving
+ * regions in a loop does not go through malloc once warmed up.
+ */
+const uint64_t RegionChunkSize = 64 * 1024;
+const uint64_t RegionAlignment = 16;
+
+struct AlRegion {
+  std::vector<char*> chunks;
+  std::vector<char*> largeChunks;
+  char *cur = nullptr;
+  char *end = nullptr;
+};
+thread_local std::vector<AlRegion> regionStack;
+thread_local std::vector<char*> freeRegionChunks;
+
+/**
+ * Type descriptors emitted by the compiler, one per struct.
+ * Objects allocated by nvAllocObj are prefixed by an AlObjectHeader holding
+ * the descriptor id, a collector finds size and pointer fields through it.
+ * Their flags carry GcObjectMagic, which tells them apart from other allocations.
+ */
+struct AlTypeDescriptor {
+  uint64_t size;
+  const uint64_t *pointerBitmap;
+  // the rc<persistent T> subset of pointerBitmap
+  const uint64_t *rcBitmap;
+};
+struct AlObjectHeader {
+  uint32_t typeId;
+  uint32_t flags;
+};
+const uint32_t GcObjectMagic = 0xa1c00000;
+const uint32_t GcObjectMagicMask = 0xffff0000;
+const AlTypeDescriptor *typeDescriptors = nullptr;
+uint32_t nTypeDescriptors = 0;
+
+/**
+ * NVM emulation on machines without persistent memory.
+ * Every persist goes through alPersist, which adds the configured latencies
+ * on top of the backend persist by spinning:
+ *   AL_NVM_FLUSH_LATENCY_NS  per flushed 64 byte cache line
+ *   AL_NVM_FENCE_LATENCY_NS  per persist (the fence after the flushes)
+ *   AL_NVM_WRITE_BW_MBPS     write bandwidth, bytes / bandwidth
+ * AL_NVM_PATH selects the directory of the (file backed) pool, "nvm" by default.
+ */
+const uint64_t CacheLineSize = 64;
+
+struct NvmLatencyModel {
+  uint64_t flushNs = 0;
+  uint64_t fenceNs = 0;
+  uint64_t writeBwMBps = 0;
+  bool enabled() const { return flushNs || fenceNs || writeBwMBps; }
+};
+NvmLatencyModel nvmLatency;
+
+uint64_t envUint64(const char *name, uint64_t defaultValue) {
+  auto s = getenv(name);
+  if (s == nullptr || *s == '\0') {
+    return defaultValue;
+  }
+  char *end;
+  auto value = strtoull(s, &end, 10);
+  if (*end != '\0') {
+    cerr << name << " is not a number '" << s << "'" << endl;
+    abort();
+  }
+  return value;
+}
+
+const char *nvmPoolPath() {
+  auto path = getenv("AL_NVM_PATH");
+  return path && *path ? path : "nvm";
+}
+
+void loadNvmLatencyModel() {
+  nvmLatency.flushNs = envUint64("AL_NVM_FLUSH_LATENCY_NS", 0);
+  nvmLatency.fenceNs = envUint64("AL_NVM_FENCE_LATENCY_NS", 0);
+  nvmLatency.writeBwMBps = envUint64("AL_NVM_WRITE_BW_MBPS", 0);
+  if (nvmLatency.enabled()) {
+    cerr << "nvm emulation: flush " << nvmLatency.flushNs << "ns/line, fence "
+         << nvmLatency.fenceNs << "ns, write bandwidth "
+         << (nvmLatency.writeBwMBps ? std::to_string(nvmLatency.writeBwMBps) + "MB/s" : "unlimited") << endl;
+  }
+}
+
+void spinNs(uint64_t ns) {
+  auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(ns);
+  while (std::chrono::steady_clock::now() < end);
+}
+
+void spinNvmLatency(uint64_t nLines, uint64_t nBytes) {
+  uint64_t ns = nLines * nvmLatency.flushNs + nvmLatency.fenceNs;
+  if (nvmLatency.writeBwMBps) {
+    // 1 MB/s moves one byte per 1000ns
+    ns += nBytes * 1000 / nvmLatency.writeBwMBps;
+  }
+  spinNs(ns);
+}
+
+/**
+ * Persist statistics (--enable-persist-stats)
+ * Compiled persists pass the id of their call site, persists done by the runtime
+ * itself (allocation, rc counts, ...) are counted under "runtime". Every thread
+ * counts into its own table, the tables are summed and printed sorted by cycles
+ * at AL__main_end, or on the next persist after SIGUSR1.
+ */
+struct AlPersistSite {
+  int32_t line;
+  const char *function;
+};
+struct PersistSiteStats {
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+  uint64_t lines = 0;
+  uint64_t cycles = 0;
+};
+// Counters of a live thread, only it writes them but dumps on other threads read them
+struct PersistSiteCounters {
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> lines{0};
+  std::atomic<uint64_t> cycles{0};
+};
+struct PersistStatsTable {
+  std::unique_ptr<PersistSiteCounters[]> sites;
+  size_t nSites = 0;
+};
+const AlPersistSite *persistSites = nullptr;
+uint32_t nPersistSites = 0;
+const char *persistSitesFile = "";
+bool persistStatsEnabled = false;
+// set by the SIGUSR1 handler, read by every persisting thread
+std::atomic<bool> persistStatsDumpRequested{false};
+
+std::mutex persistStatsMutex;
+std::vector<PersistStatsTable*> persistStatsTables;
+// tables of threads that exited
+std::vector<PersistSiteStats> persistStatsRetired;
+thread_local int32_t currentPersistSite = -1;
+
+void mergePersistStats(std::vector<PersistSiteStats> &to, const PersistStatsTable &from) {
+  to.resize(std::max(to.size(), from.nSites));
+  for (size_t i = 0; i < from.nSites; ++i) {
+    to[i].count += from.sites[i].count.load(std::memory_order_relaxed);
+    to[i].bytes += from.sites[i].bytes.load(std::memory_order_relaxed);
+    to[i].lines += from.sites[i].lines.load(std::memory_order_relaxed);
+    to[i].cycles += from.sites[i].cycles.load(std::memory_order_relaxed);
+  }
+}
+
+// Called by the owning thread, the lock keeps dumps from reading the old sites
+void resizePersistStats(PersistStatsTable &table, size_t nSites) {
+  std::unique_ptr<PersistSiteCounters[]> sites(new PersistSiteCounters[nSites]);
+  std::lock_guard<std::mutex> lock(persistStatsMutex);
+  for (size_t i = 0; i < std::min(nSites, table.nSites); ++i) {
+    sites[i].count.store(table.sites[i].count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    sites[i].bytes.store(table.sites[i].bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    sites[i].lines.store(table.sites[i].lines.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    sites[i].cycles.store(table.sites[i].cycles.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+  table.sites.swap(sites);
+  table.nSites = nSites;
+}
+
+// Single writer, a relaxed load and store is enough and avoids a locked add
+void addRelaxed(std::atomic<uint64_t> &counter, uint64_t value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+struct PersistStatsRegistration {
+  PersistStatsTable table;
+  PersistStatsRegistration() {
+    resizePersistStats(table, nPersistSites + 1);
+    std::lock_guard<std::mutex> lock(persistStatsMutex);
+    persistStatsTables.push_back(&table);
+  }
+  ~PersistStatsRegistration() {
+    std::lock_guard<std::mutex> lock(persistStatsMutex);
+    mergePersistStats(persistStatsRetired, table);
+    persistStatsTables.erase(std::find(persistStatsTables.begin(), persistStatsTables.end(), &table));
+  }
+};
+
+PersistStatsTable &persistStatsTable() {
+  static thread_local PersistStatsRegistration registration;
+  return registration.table;
+}
+
+uint64_t readCycles() {
+#if defined(__x86_64__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void dumpPersistStats() {
+  std::vector<PersistSiteStats> total;
+  {
+    std::lock_guard<std::mutex> lock(persistStatsMutex);
+    total = persistStatsRetired;
+    for (auto table : persistStatsTables) {
+      mergePersistStats(total, *table);
+    }
+  }
+  total.resize(nPersistSites + 1);
+
+  std::vector<uint32_t> order;
+  for (uint32_t i = 0; i < total.size(); ++i) {
+    if (total[i].count) {
+      order.push_back(i);
+    }
+  }
+  std::sort(order.begin(), order.end(), [&total](uint32_t a, uint32_t b) {
+    return total[a].cycles > total[b].cycles;
+  });
+
+  PersistSiteStats sum;
+  for (auto &stats : total) {
+    sum.count += stats.count;
+    sum.lines += stats.lines;
+  }
+  cerr << "persist stats total: " << sum.count << " persists, " << sum.lines << " cache lines" << endl;
+  cerr << "persist stats: site, persists, bytes, cache lines, cycles" << endl;
+  for (auto i : order) {
+    if (i == nPersistSites) {
+      cerr << "  runtime";
+    } else {
+      cerr << "  " << persistSitesFile << ":" << persistSites[i].line << " " << persistSites[i].function;
+    }
+    cerr << ", " << total[i].count << ", " << total[i].bytes << ", " << total[i].lines << ", " << total[i].cycles << endl;
+  }
+}
+
+void requestPersistStatsDump(int) {
+  persistStatsDumpRequested.store(true);
+}
+
+/**
+ * Persist trace (AL_NVM_TRACE=<file>)
+ * Every flush and fence done by alPersist, and with --enable-persist-trace every store the
+ * compiler emits into NVM, is appended to a per-thread buffer of fixed size records which
+ * is written to the trace file when full and when its thread exits. The site table
+ * registered for persist statistics is appended when the trace is closed at AL__main_end,
+ * records of threads still running by then are dropped.
+ */
+const size_t TraceBufferRecords = 1 << 14;
+FILE *traceFile = nullptr;
+std::mutex traceMutex;
+std::atomic<uint16_t> traceNextThread(0);
+bool persistTraceEnabled = false;
+
+void writeTraceRecords(const std::vector<AlTraceRecord> &records) {
+  std::lock_guard<std::mutex> lock(traceMutex);
+  if (traceFile != nullptr && !records.empty()) {
+    fwrite(records.data(), sizeof(AlTraceRecord), records.size(), traceFile);
+  }
+}
+
+struct TraceBuffer {
+  uint16_t thread = traceNextThread++;
+  std::vector<AlTraceRecord> records;
+  TraceBuffer() {
+    records.reserve(TraceBufferRecords);
+  }
+  ~TraceBuffer() {
+    writeTraceRecords(records);
+  }
+};
+
+TraceBuffer &traceBuffer() {
+  static thread_local TraceBuffer buffer;
+  return buffer;
+}
+
+void traceRecord(AlTraceKind kind, const void *addr, uint64_t size) {
+  auto &buffer = traceBuffer();
+  AlTraceRecord record = {};
+  record.timestamp = readCycles();
+  record.addr = (uint64_t)addr;
+  record.size = (uint32_t)size;
+  record.site = currentPersistSite;
+  record.thread = buffer.thread;
+  record.kind = kind;
+  buffer.records.push_back(record);
+  if (buffer.records.size() == TraceBufferRecords) {
+    writeTraceRecords(buffer.records);
+    buffer.records.clear();
+  }
+}
+
+void openPersistTrace() {
+  auto path = getenv("AL_NVM_TRACE");
+  if (path == nullptr || *path == '\0') {
+    return;
+  }
+  traceFile = fopen(path, "wb");
+  if (traceFile == nullptr) {
+    cerr << "cannot open trace file " << path << endl;
+    abort();
+  }
+  AlTraceHeader header = {};
+  memcpy(header.magic, AlTraceMagic, sizeof(header.magic));
+  header.version = AlTraceVersion;
+  header.recordSize = sizeof(AlTraceRecord);
+  fwrite(&header, sizeof(header), 1, traceFile);
+  persistTraceEnabled = true;
+}
+
+void closePersistTrace() {
+  auto &buffer = traceBuffer();
+  writeTraceRecords(buffer.records);
+  buffer.records.clear();
+
+  std::lock_guard<std::mutex> lock(traceMutex);
+  persistTraceEnabled = false;
+  AlTraceTrailer trailer = {};
+  trailer.siteTableOffset = (uint64_t)ftell(traceFile);
+  trailer.nSites = nPersistSites;
+  memcpy(trailer.magic, AlTraceTrailerMagic, sizeof(trailer.magic));
+  auto writeString = [](const char *s) {
+    uint32_t len = (uint32_t)strlen(s);
+    fwrite(&len, sizeof(len), 1, traceFile);
+    fwrite(s, 1, len, traceFile);
+  };
+  for (uint32_t i = 0; i < nPersistSites; ++i) {
+    fwrite(&persistSites[i].line, sizeof(int32_t), 1, traceFile);
+    writeString(persistSites[i].function);
+  }
+  writeString(persistSitesFile);
+  fwrite(&trailer, sizeof(trailer), 1, traceFile);
+  fclose(traceFile);
+  traceFile = nullptr;
+}
+
+/**
+ * Profile (--profile-generate <file>)
+ * Compiled code counts function entries and condition edges into one array, written
+ * to the file at AL__main_end as
+ *   al-profile 1
+ *   <function> <entry count> <number of branches>
+ *   <true count> <false count>    one line per branch
+ */
+struct AlProfileFunction {
+  const char *name;
+  uint32_t firstCounter;
+  uint32_t nBranches;
+};
+const uint64_t *profileCounters = nullptr;
+const AlProfileFunction *profileFunctions = nullptr;
+uint32_t nProfileFunctions = 0;
+const char *profilePath = nullptr;
+
+void writeProfile() {
+  FILE *f = fopen(profilePath, "w");
+  if (f == nullptr) {
+    cerr << "cannot write profile " << profilePath << endl;
+    return;
+  }
+  fprintf(f, "al-profile 1\n");
+  for (uint32_t i = 0; i < nProfileFunctions; ++i) {
+    auto &function = profileFunctions[i];
+    auto counters = profileCounters + function.firstCounter;
+    fprintf(f, "%s %llu %u\n", function.name, (unsigned long long)counters[0], function.nBranches);
+    for (uint32_t b = 0; b < function.nBranches; ++b) {
+      fprintf(f, "%llu %llu\n", (unsigned long long)counters[1 + 2 * b], (unsigned long long)counters[2 + 2 * b]);
+    }
+  }
+  fclose(f);
+}
+
+void alPersist(const void *ptr, uint64_t nBytes) {
+  uint64_t start = persistStatsEnabled ? readCycles() : 0;
+  if (persistTraceEnabled) {
+    traceRecord(AlTraceFlush, ptr, nBytes);
+    traceRecord(AlTraceFence, ptr, 0);
+  }
+  nvmBackend().persist(ptr, nBytes);
+  auto first = (uintptr_t)ptr / CacheLineSize;
+  auto last = ((uintptr_t)ptr + nBytes + CacheLineSize - 1) / CacheLineSize;
+  if (nvmLatency.enabled()) {
+    spinNvmLatency(last - first, nBytes);
+  }
+
+  if (persistStatsEnabled) {
+    auto &table = persistStatsTable();
+    auto site = currentPersistSite < 0 ? nPersistSites : (uint32_t)currentPersistSite;
+    if (site >= table.nSites) {
+      // the table was created before the sites were registered
+      resizePersistStats(table, nPersistSites + 1);
+    }
+    auto &stats = table.sites[site];
+    addRelaxed(stats.count, 1);
+    addRelaxed(stats.bytes, nBytes);
+    addRelaxed(stats.lines, last - first);
+    addRelaxed(stats.cycles, readCycles() - start);
+    if (persistStatsDumpRequested.load(std::memory_order_relaxed) && persistStatsDumpRequested.exchange(false)) {
+      dumpPersistStats();
+    }
+  }
+}
+
+
+/**
+ * Relative NVM pointers (--enable-relative-nvm-ptr)
+ * NVM pointers stored in NVM hold their offset from al_nvm_base, null stays 0.
+ * Runtime functions reading or writing pointers inside NVM objects go through
+ * nvmPtrLoad/nvmPtrStore, out-parameters are always absolute.
+ */
+extern "C" {
+DLLEXPORT int64_t al_nvm_base = 0;
+}
+bool relativeNvmPtr = false;
+
+void *nvmPtrLoad(void **slot) {
+  if (!relativeNvmPtr || *slot == nullptr) {
+    return *slot;
+  }
+  return (void*)((int64_t)*slot + al_nvm_base);
+}
+
+void nvmPtrStore(void **slot, void *p) {
+  if (!relativeNvmPtr || p == nullptr) {
+    *slot = p;
+  } else {
+    *slot = (void*)((int64_t)p - al_nvm_base);
+  }
+}
+
+/**
+ * Reference counted persistent objects, rc<persistent T>.
+ * Compiled code calls alRcInc/alRcDec on every copy, they only append to a thread
+ * local log. The log is applied in batches (when full, on rcEpoch() and at exit):
+ * deltas of the same object are coalesced and each changed count is persisted once.
+ * Objects reaching zero are freed after every thread has flushed its log since,
+ * so an increment still sitting in another thread's log can revive them.
+ * Counts in NVM are therefore only consistent at epoch boundaries.
+ * rcEpoch() asks threads lagging behind to flush on their next count update, a thread
+ * that stops updating counts keeps objects queued until it calls rcEpoch() or exits.
+ */
+struct AlRcHeader {
+  int64_t count;
+  uint32_t typeId;
+  uint32_t flags;
+};
+const size_t RcLogSize = 4096;
+// AlRcHeader::flags, set while the object is in rcZeroCount
+const uint32_t RcZeroCountQueued = 1;
+
+struct RcThreadState {
+  std::vector<std::pair<AlRcHeader*, int32_t>> log;
+  uint64_t flushedEpoch = 0;
+  // set by rcAdvanceEpoch when the thread is behind, checked by rcLog
+  std::atomic<bool> flushRequested{false};
+};
+std::mutex rcMutex;
+uint64_t rcCurrentEpoch = 1;
+std::vector<RcThreadState*> rcThreads;
+// objects whose count dropped to zero, with the epoch it happened in
+std::vector<std::pair<AlRcHeader*, uint64_t>> rcZeroCount;
+// set by the first count update, programs without rc skip the drain at exit
+std::atomic<bool> rcUsed{false};
+
+void rcFlushLocked(RcThreadState &state);
+
+void rcQueueZeroCount(AlRcHeader *header) {
+  if (!(header->flags & RcZeroCountQueued)) {
+    header->flags |= RcZeroCountQueued;
+    rcZeroCount.emplace_back(header, rcCurrentEpoch);
+  }
+}
+
+struct RcThreadRegistration {
+  RcThreadState state;
+  RcThreadRegistration() {
+    state.log.reserve(RcLogSize);
+    std::lock_guard<std::mutex> lock(rcMutex);
+    state.flushedEpoch = rcCurrentEpoch;
+    rcThreads.push_back(&state);
+  }
+  ~RcThreadRegistration() {
+    std::lock_guard<std::mutex> lock(rcMutex);
+    rcFlushLocked(state);
+    rcThreads.erase(std::find(rcThreads.begin(), rcThreads.end(), &state));
+  }
+};
+
+RcThreadState &rcThreadState() {
+  // Flushed and unregistered when the thread exits
+  static thread_local RcThreadRegistration registration;
+  return registration.state;
+}
+
+AlRcHeader *rcHeader(void *obj) {
+  return (AlRcHeader*)obj - 1;
+}
+
+void rcFreeObject(AlRcHeader *header) {
+  // the references held by the object are dropped with it
+  auto desc = &typeDescriptors[header->typeId];
+  auto words = (void**)(header + 1);
+  for (uint64_t i = 0; i < (desc->size + 7) / 8; ++i) {
+    if (((desc->rcBitmap[i / 64] >> (i % 64)) & 1) && words[i] != nullptr) {
+      auto child = rcHeader(nvmPtrLoad(&words[i]));
+      child->count -= 1;
+      alPersist(&child->count, sizeof(child->count));
+      if (child->count <= 0) {
+        rcQueueZeroCount(child);
+      }
+    }
+  }
+  nvmBackend().free(header, nullptr, nullptr, nullptr, nullptr);
+}
+
+void rcFlushLocked(RcThreadState &state) {
+  std::map<AlRcHeader*, int64_t> deltas;
+  for (auto &item : state.log) {
+    deltas[item.first] += item.second;
+  }
+  state.log.clear();
+
+  for (auto &item : deltas) {
+    if (item.second == 0) {
+      continue;
+    }
+    auto header = item.first;
+    header->count += item.second;
+    alPersist(&header->count, sizeof(header->count));
+    if (header->count <= 0) {
+      rcQueueZeroCount(header);
+    }
+  }
+  state.flushedEpoch = rcCurrentEpoch;
+  state.flushRequested.store(false, std::memory_order_relaxed);
+}
+
+// Free zero count objects no thread log can refer to anymore, returns how many
+size_t rcCollectLocked() {
+  auto minEpoch = rcCurrentEpoch;
+  for (auto thread : rcThreads) {
+    minEpoch = std::min(minEpoch, thread->flushedEpoch);
+  }
+
+  std::vector<std::pair<AlRcHeader*, uint64_t>> ready;
+  std::vector<std::pair<AlRcHeader*, uint64_t>> pending;
+  for (auto &item : rcZeroCount) {
+    (item.second < minEpoch ? ready : pending).push_back(item);
+  }
+  // children reaching zero are queued again, in the current epoch
+  rcZeroCount.swap(pending);
+  size_t nFreed = 0;
+  for (auto &item : ready) {
+    item.first->flags &= ~RcZeroCountQueued;
+    // revived by an increment applied after it reached zero
+    if (item.first->count <= 0) {
+      rcFreeObject(item.first);
+      nFreed++;
+    }
+  }
+  return nFreed;
+}
+
+size_t rcAdvanceEpoch() {
+  auto &state = rcThreadState();
+  std::lock_guard<std::mutex> lock(rcMutex);
+  rcFlushLocked(state);
+  rcCurrentEpoch++;
+  for (auto thread : rcThreads) {
+    if (thread != &state && thread->flushedEpoch < rcCurrentEpoch) {
+      thread->flushRequested.store(true, std::memory_order_relaxed);
+    }
+  }
+  return rcCollectLocked();
+}
+
+void rcLog(void *obj, int32_t delta) {
+  if (obj == nullptr) {
+    return;
+  }
+  if (!rcUsed.load(std::memory_order_relaxed)) {
+    rcUsed.store(true, std::memory_order_relaxed);
+  }
+  auto &state = rcThreadState();
+  state.log.emplace_back(rcHeader(obj), delta);
+  if (state.log.size() >= RcLogSize || state.flushRequested.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(rcMutex);
+    rcFlushLocked(state);
+  }
+}
+
+void *regionAlloc(uint64_t nBytes) {
+  if (regionStack.empty()) {
+    cerr << "volatile allocation outside of a region" << endl;
+    abort();
+  }
+  auto &region = regionStack.back();
+  nBytes = (nBytes + RegionAlignment - 1) & ~(RegionAlignment - 1);
+
+  if (nBytes > RegionChunkSize / 4) {
+    auto p = (char*)malloc(nBytes);
+    region.largeChunks.push_back(p);
+    return p;
+  }
+
+  if (region.cur == nullptr || region.cur + nBytes > region.end) {
+    char *chunk;
+    if (freeRegionChunks.empty()) {
+      chunk = (char*)malloc(RegionChunkSize);
+    } else {
+      chunk = freeRegionChunks.back();
+      freeRegionChunks.pop_back();
+    }
+    region.chunks.push_back(chunk);
+    region.cur = chunk;
+    region.end = chunk + RegionChunkSize;
+  }
+  auto p = region.cur;
+  region.cur += nBytes;
+  return p;
+}
+
+/**
+ * Timing
+ * Timestamps are TSC reads converted to nanoseconds with a ratio calibrated once
+ * against steady_clock. Timers and histograms are addressed by small integer ids and
+ * live in fixed tables, recording never allocates.
+ * Histograms are HDR-like: values below 2 * HistHalfBuckets are exact, above they
+ * keep the top bits of the value, so every bucket is within 1 / HistHalfBuckets of it.
+ */
+const int MaxTimers = 32;
+const uint32_t HistHalfBucketsBits = 5;
+const uint64_t HistHalfBuckets = 1 << HistHalfBucketsBits;
+const uint32_t HistBuckets = 2 * HistHalfBuckets + (63 - HistHalfBucketsBits) * HistHalfBuckets;
+
+struct AlHistogram {
+  std::atomic<uint64_t> buckets[HistBuckets];
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> total;
+  std::atomic<uint64_t> max;
+};
+AlHistogram histograms[MaxTimers];
+thread_local uint64_t timerStarts[MaxTimers];
+
+// Set once by alLibInit, so no measured interval pays for the calibration
+double nsPerCycle = 1.0;
+
+void calibrateCycles() {
+#if defined(__x86_64__)
+  auto ns0 = std::chrono::steady_clock::now();
+  auto c0 = readCycles();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  auto c1 = readCycles();
+  auto ns1 = std::chrono::steady_clock::now();
+  nsPerCycle = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(ns1 - ns0).count() / (double)(c1 - c0);
+#else
+  // readCycles is in nanoseconds already
+  nsPerCycle = 1.0;
+#endif
+}
+
+int64_t cyclesToNs(uint64_t cycles) {
+  return (int64_t)((double)cycles * nsPerCycle);
+}
+
+uint32_t histBucket(uint64_t value) {
+  if (value < 2 * HistHalfBuckets) {
+    return (uint32_t)value;
+  }
+  uint32_t shift = 63 - __builtin_clzll(value) - HistHalfBucketsBits;
+  return (uint32_t)(2 * HistHalfBuckets + (shift - 1) * HistHalfBuckets + ((value >> shift) - HistHalfBuckets));
+}
+
+// Highest value falling into bucket
+uint64_t histBucketValue(uint32_t bucket) {
+  if (bucket < 2 * HistHalfBuckets) {
+    return bucket;
+  }
+  uint32_t shift = (bucket - 2 * HistHalfBuckets) / HistHalfBuckets + 1;
+  uint64_t top = (bucket - 2 * HistHalfBuckets) % HistHalfBuckets + HistHalfBuckets;
+  return ((top + 1) << shift) - 1;
+}
+
+AlHistogram &histogram(int32_t id) {
+  if (id < 0 || id >= MaxTimers) {
+    cerr << "timer/histogram id " << id << " out of range [0, " << MaxTimers << ")" << endl;
+    abort();
+  }
+  return histograms[id];
+}
+
+void histRecordValue(AlHistogram &hist, int64_t value) {
+  uint64_t v = value < 0 ? 0 : (uint64_t)value;
+  hist.buckets[histBucket(v)].fetch_add(1, std::memory_order_relaxed);
+  hist.count.fetch_add(1, std::memory_order_relaxed);
+  hist.total.fetch_add(v, std::memory_order_relaxed);
+  auto max = hist.max.load(std::memory_order_relaxed);
+  while (v > max && !hist.max.compare_exchange_weak(max, v, std::memory_order_relaxed));
+}
+
+uint64_t histPercentile(const AlHistogram &hist, uint64_t count, double percentile) {
+  auto rank = (uint64_t)(percentile / 100.0 * (double)count + 0.5);
+  rank = std::max<uint64_t>(rank, 1);
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < HistBuckets; ++i) {
+    seen += hist.buckets[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      return std::min(histBucketValue(i), hist.max.load(std::memory_order_relaxed));
+    }
+  }
+  return hist.max.load(std::memory_order_relaxed);
+}
+
 extern "C" {
 
+/**
+ * GC write barrier (--enable-gc-write-barrier)
+ * Compiled code checks alGcMarking before every pointer store into NVM and calls
+ * alGcWriteBarrier while it is set. A concurrent/incremental collector installs
+ * its hook and toggles the flag around its mark phase.
+ */
+typedef void (*AlGcWriteBarrierHook)(void **slot, void *oldVal, void *newVal);
+DLLEXPORT volatile int32_t alGcMarking = 0;
+static AlGcWriteBarrierHook gcWriteBarrierHook = nullptr;
+
+DLLEXPORT void alGcSetWriteBarrierHook(AlGcWriteBarrierHook hook) {
+  gcWriteBarrierHook = hook;
+}
+
+DLLEXPORT void alGcSetMarking(int32_t marking) {
+  alGcMarking = marking;
+}
+
+DLLEXPORT void alGcWriteBarrier(void **slot, void *newVal) {
+  auto hook = gcWriteBarrierHook;
+  if (hook) {
+    hook(slot, nvmPtrLoad(slot), newVal);
+  }
+}
+
+/**
+ * GC shadow stack (--enable-gc-shadow-stack)
+ * Every thread has a chain of frames linked by the functions that hold NVM pointers
+ * on their stacks. The collector visits them with the mutators stopped.
+ */
+struct AlGcFrame {
+  AlGcFrame *prev;
+  uint32_t nRoots;
+  void **roots[0];
+};
+typedef void (*AlGcRootVisitor)(void **slot, void *ctx);
+thread_local AlGcFrame *gcRootChain = nullptr;
+std::mutex gcRootChainsMutex;
+std::map<std::thread::id, AlGcFrame**> gcRootChains;
+
+struct GcRootChainRegistration {
+  GcRootChainRegistration() {
+    std::lock_guard<std::mutex> lock(gcRootChainsMutex);
+    gcRootChains[std::this_thread::get_id()] = &gcRootChain;
+  }
+  ~GcRootChainRegistration() {
+    std::lock_guard<std::mutex> lock(gcRootChainsMutex);
+    gcRootChains.erase(std::this_thread::get_id());
+  }
+};
+
+void registerGcRootChain() {
+  // Unregistered when the thread exits
+  static thread_local GcRootChainRegistration registration;
+  (void)registration;
+}
+
+DLLEXPORT AlGcFrame **alGcRootChain() {
+  return &gcRootChain;
+}
+
+DLLEXPORT void alGcVisitStackRoots(AlGcRootVisitor visitor, void *ctx) {
+  std::lock_guard<std::mutex> lock(gcRootChainsMutex);
+  for (auto &item : gcRootChains) {
+    for (auto frame = *item.second; frame != nullptr; frame = frame->prev) {
+      for (uint32_t i = 0; i < frame->nRoots; ++i) {
+        visitor(frame->roots[i], ctx);
+      }
+    }
+  }
+}
+
 DLLEXPORT void alLibInit() {
   threadNames = new std::map<std::thread::id, std::string>;
+  calibrateCycles();
 }
 
 DLLEXPORT void howAreYou() {
   cout << "howareyou" << endl;
 }
 
+DLLEXPORT void alEnablePersistStats();
+DLLEXPORT void gcDump();
+
 DLLEXPORT void nvmSetup() {
-  nvm_initialize("nvm", 1);
+  loadNvmLatencyModel();
+  openPersistTrace();
+  if (envUint64("AL_NVM_PERSIST_STATS", 0)) {
+    // counts runtime persists, e.g. of programs not compiled with --enable-persist-stats
+    alEnablePersistStats();
+  }
+  nvmInitialize(nvmPoolPath());
+  al_nvm_base = (int64_t)nvmBackend().abs(nullptr);
+}
+
+DLLEXPORT void alSetRelativeNvmPtr(int32_t enabled) {
+  relativeNvmPtr = enabled != 0;
 }
 
 DLLEXPORT void threadLocalSetup(const char *name) {
   (*threadNames)[std::this_thread::get_id()] = name;
-  nvm_initialize("nvm", 1);
+  registerGcRootChain();
+  nvmInitialize(nvmPoolPath());
 }
 
 DLLEXPORT void threadLocalSetupMain() {
   (*threadNames)[std::this_thread::get_id()] = "main";
-  nvm_initialize("nvm", 1);
+  registerGcRootChain();
+  nvmInitialize(nvmPoolPath());
 }
 
 DLLEXPORT const char *getThreadName() {
@@ -84,17 +898,34 @@ DLLEXPORT void setIntNvmVar(int intId, int value) {
   stringstream ss;
   ss << intId;
   ss >> name;
-  int *p = (int*) nvm_get_id(name.c_str());
+  int *p = (int*) nvmBackend().getId(name.c_str());
   if (p == nullptr) {
-    p = (int *) nvm_reserve_id(name.c_str(), 4);
+    p = (int *) nvmBackend().reserveId(name.c_str(), 4);
   }
 
   *p = value;
-  nvm_persist(p, 4);
-  nvm_activate_id(name.c_str());
+  alPersist(p, 4);
+  nvmBackend().activateId(name.c_str());
 }
 
 DLLEXPORT void AL__main_end() {
+  if (rcUsed.load()) {
+    // objects reaching zero in one epoch are freed in the next one
+    rcAdvanceEpoch();
+    while (rcAdvanceEpoch() > 0);
+  }
+  if (persistStatsEnabled) {
+    dumpPersistStats();
+  }
+  if (traceFile != nullptr) {
+    closePersistTrace();
+  }
+  if (profilePath != nullptr) {
+    writeProfile();
+  }
+  if (envUint64("AL_GC_STATS", 0)) {
+    gcDump();
+  }
   cout << "bye" << endl;
   // FIXME: maybe we should not exit by ourself. Because we may leak libcpp resources
   exit(0);
@@ -103,9 +934,9 @@ DLLEXPORT void AL__main_end() {
 
 DLLEXPORT void *getNvmVar(int id, uint64_t size) {
   auto name = getNvmVarNameById(getThreadName(), id);
-  void *p = nvm_get_id(name.c_str());
+  void *p = nvmBackend().getId(name.c_str());
   if (p == nullptr) {
-    p = nvm_reserve_id(name.c_str(), size);
+    p = nvmBackend().reserveId(name.c_str(), size);
   }
   nvmVarMap[{getThreadName(), p, size}] = name;
 
@@ -117,13 +948,47 @@ DLLEXPORT int getIntNvmVar(int intId) {
 }
 DLLEXPORT void persistNvmVar(int id, uint64_t size) {
   auto name = getNvmVarNameById(getThreadName(), id);
-  void *p = nvm_get_id(name.c_str());
+  void *p = nvmBackend().getId(name.c_str());
   if (p == nullptr) {
-    p = nvm_reserve_id(name.c_str(), size);
+    p = nvmBackend().reserveId(name.c_str(), size);
   }
 
-  nvm_persist(p, size);
-  nvm_activate_id(name.c_str());
+  alPersist(p, size);
+  nvmBackend().activateId(name.c_str());
+}
+
+DLLEXPORT void persistNvmVarByAddr(char *ptr, uint64_t size, int ok);
+
+DLLEXPORT void persistNvmVarByAddrAt(char *ptr, uint64_t size, int ok, int32_t site) {
+  currentPersistSite = site;
+  persistNvmVarByAddr(ptr, size, ok);
+  currentPersistSite = -1;
+}
+
+DLLEXPORT void alRegisterPersistSites(const AlPersistSite *sites, uint32_t n, const char *file) {
+  persistSites = sites;
+  nPersistSites = n;
+  persistSitesFile = file;
+}
+
+DLLEXPORT void alRegisterProfile(const uint64_t *counters, const AlProfileFunction *functions, uint32_t n, const char *path) {
+  profileCounters = counters;
+  profileFunctions = functions;
+  nProfileFunctions = n;
+  profilePath = path;
+}
+
+DLLEXPORT void alEnablePersistStats() {
+  persistStatsEnabled = true;
+  signal(SIGUSR1, requestPersistStatsDump);
+}
+
+DLLEXPORT void alTraceStore(void *ptr, uint64_t size, int32_t site) {
+  if (persistTraceEnabled) {
+    currentPersistSite = site;
+    traceRecord(AlTraceStore, ptr, size);
+    currentPersistSite = -1;
+  }
 }
 
 DLLEXPORT void persistNvmVarByAddr(char *ptr, uint64_t size, int ok) {
@@ -131,11 +996,11 @@ DLLEXPORT void persistNvmVarByAddr(char *ptr, uint64_t size, int ok) {
     return;
   }
 
-  nvm_persist(ptr, size);
+  alPersist(ptr, size);
 
   if (nvmVarMap.find({getThreadName(), ptr, size}) != nvmVarMap.end()) {
     auto name = nvmVarMap[{getThreadName(), ptr, size}];
-    nvm_activate_id(name.c_str());
+    nvmBackend().activateId(name.c_str());
     return;
   }
   else {
@@ -148,7 +1013,7 @@ DLLEXPORT void persistNvmVarByAddr(char *ptr, uint64_t size, int ok) {
       if (threadName == getThreadName() && relPtr <= ptr && ptr < (char*)relPtr + len) {
         auto name = item.second;
 //        cerr << "inner nvm memory found: " << name << ", " << (void*)ptr << ", offset " << (void*)(ptr - (char*)item.first.first) << endl;
-        nvm_activate_id(name.c_str());
+        nvmBackend().activateId(name.c_str());
         return;
       }
     }
@@ -157,42 +1022,843 @@ DLLEXPORT void persistNvmVarByAddr(char *ptr, uint64_t size, int ok) {
 //  cerr << "nvm memory nout found: " << (void*)ptr << " " << size << endl;
 }
 
+// Collector hooks, see the garbage collector below
+void gcOutSlotBarrier(void **slot);
+void gcAllocationStep(uint64_t nBytes);
+bool gcCycleInProgress();
+
 DLLEXPORT void nvAllocInt32(int **i32) {
+  gcOutSlotBarrier((void **)i32);
   *i32 = nullptr;
-  auto ptr = nvm_reserve(sizeof(int));
-  nvm_persist(ptr, sizeof(int));
-  nvm_activate(ptr, (void **)i32, ptr, nullptr, nullptr);
+  auto ptr = nvmBackend().reserve(sizeof(int));
+  alPersist(ptr, sizeof(int));
+  nvmBackend().activate(ptr, (void **)i32, ptr, nullptr, nullptr);
   // TODO i32 is a relative pointer, but in al we assure all pointers are absolute pointers
-  *i32 = (int*)nvm_abs(*i32);
+  *i32 = (int*)nvmBackend().abs(*i32);
 }
+// Persists [ptr, ptr + nBytes) for C/C++ callers, e.g. the benchmark baselines
+DLLEXPORT void nvPersist(void *ptr, uint64_t nBytes) {
+  alPersist(ptr, nBytes);
+}
+
 DLLEXPORT void nvAllocNBytes(int **i32, uint32_t nBytes) {
+  gcOutSlotBarrier((void **)i32);
   *i32 = nullptr;
-  auto ptr = nvm_reserve(nBytes);
-  nvm_persist(ptr, nBytes);
-  nvm_activate(ptr, (void **)i32, ptr, nullptr, nullptr);
+  auto ptr = nvmBackend().reserve(nBytes);
+  alPersist(ptr, nBytes);
+  nvmBackend().activate(ptr, (void **)i32, ptr, nullptr, nullptr);
   // TODO i32 is a relative pointer, but in al we assure all pointers are absolute pointers
-  *i32 = (int*)nvm_abs(*i32);
+  *i32 = (int*)nvmBackend().abs(*i32);
+}
+
+DLLEXPORT void alRegisterTypeDescriptors(const AlTypeDescriptor *descs, uint32_t n) {
+  typeDescriptors = descs;
+  nTypeDescriptors = n;
+}
+
+DLLEXPORT const AlTypeDescriptor *alGetTypeDescriptor(uint32_t typeId) {
+  if (typeId >= nTypeDescriptors) {
+    cerr << "invalid type id " << typeId << endl;
+    abort();
+  }
+  return &typeDescriptors[typeId];
+}
+
+DLLEXPORT uint32_t alGetObjectTypeId(void *obj) {
+  return ((AlObjectHeader*)obj - 1)->typeId;
+}
+
+DLLEXPORT void nvAllocObj(int **i32, uint32_t typeId) {
+  auto desc = alGetTypeDescriptor(typeId);
+  gcAllocationStep(sizeof(AlObjectHeader) + desc->size);
+  gcOutSlotBarrier((void **)i32);
+  *i32 = nullptr;
+  auto ptr = (AlObjectHeader*)nvmBackend().reserve(sizeof(AlObjectHeader) + desc->size);
+  ptr->typeId = typeId;
+  ptr->flags = GcObjectMagic;
+  alPersist(ptr, sizeof(AlObjectHeader) + desc->size);
+  nvmBackend().activate(ptr, (void **)i32, ptr + 1, nullptr, nullptr);
+  // TODO i32 is a relative pointer, but in al we assure all pointers are absolute pointers
+  *i32 = (int*)nvmBackend().abs(*i32);
+}
+
+/**
+ * Compaction of a persistent object graph allocated by nvAllocObj.
+ * Every object reachable from *root is copied into freshly reserved memory, in
+ * traversal (depth first, field order) or allocation order, with its pointer
+ * fields redirected to the copies. The copies are persisted and activated before
+ * *root is switched with a single 8 byte store, so after a crash *root points to
+ * either the old or the new graph, at worst leaking the other one.
+ * Other references into the graph must be in registered shadow stack roots
+ * (--enable-gc-shadow-stack), which are fixed up, and no other thread may use
+ * the graph meanwhile. Volatile locals holding pointers into the graph are not
+ * fixed up and dangle afterwards, they must be reloaded from the root.
+ * Programs compiled with --nvm-compact call it before AL__main, when nothing but
+ * the root refers to the graph yet. Every reachable object must come from nvAllocObj,
+ * nvCompact aborts on one without a valid header.
+ */
+const int32_t CompactTraversalOrder = 0;
+const int32_t CompactAllocationOrder = 1;
+
+AlObjectHeader *objHeader(void *obj) {
+  return (AlObjectHeader*)obj - 1;
+}
+
+uint64_t objAllocSize(void *obj) {
+  return sizeof(AlObjectHeader) + alGetTypeDescriptor(objHeader(obj)->typeId)->size;
+}
+
+// The magic is cleared first, a block reused by nvAllocNBytes must not pass for an object
+void objFree(void *obj) {
+  auto header = objHeader(obj);
+  header->flags = 0;
+  alPersist(&header->flags, sizeof(header->flags));
+  nvmBackend().free(header, nullptr, nullptr, nullptr, nullptr);
+}
+
+// Slots of obj holding non null pointers, rc objects are left where they are
+std::vector<void**> pointerFields(void *obj) {
+  std::vector<void**> fields;
+  auto desc = alGetTypeDescriptor(objHeader(obj)->typeId);
+  auto words = (void**)obj;
+  for (uint64_t i = 0; i < (desc->size + 7) / 8; ++i) {
+    auto bits = desc->pointerBitmap[i / 64] & ~desc->rcBitmap[i / 64];
+    if (((bits >> (i % 64)) & 1) && words[i] != nullptr) {
+      fields.push_back(&words[i]);
+    }
+  }
+  return fields;
+}
+
+// Mean distance in bytes between objects visited one after another
+double meanStride(const std::vector<void*> &objs) {
+  if (objs.size() < 2) {
+    return 0;
+  }
+  double sum = 0;
+  for (size_t i = 1; i < objs.size(); ++i) {
+    auto a = (char*)objs[i - 1], b = (char*)objs[i];
+    sum += a < b ? b - a : a - b;
+  }
+  return sum / (objs.size() - 1);
+}
+
+DLLEXPORT void nvCompact(void **root, int32_t order) {
+  if (*root == nullptr) {
+    return;
+  }
+  if (gcCycleInProgress()) {
+    cerr << "nvCompact: cannot run during a gc cycle" << endl;
+    abort();
+  }
+  auto rootObj = nvmPtrLoad(root);
+
+  // depth first, children in field order
+  std::vector<void*> objs;
+  std::map<void*, void*> relocation;
+  std::vector<void*> stack{rootObj};
+  while (!stack.empty()) {
+    auto obj = stack.back();
+    stack.pop_back();
+    if (relocation.count(obj)) {
+      continue;
+    }
+    auto header = objHeader(obj);
+    if ((header->flags & GcObjectMagicMask) != GcObjectMagic || header->typeId >= nTypeDescriptors) {
+      cerr << "nvCompact: " << obj << " was not allocated by nvAllocObj" << endl;
+      abort();
+    }
+    relocation[obj] = nullptr;
+    objs.push_back(obj);
+
+    auto fields = pointerFields(obj);
+    for (auto it = fields.rbegin(); it != fields.rend(); ++it) {
+      stack.push_back(nvmPtrLoad(*it));
+    }
+  }
+  auto strideBefore = meanStride(objs);
+
+  auto layout = objs;
+  if (order == CompactAllocationOrder) {
+    std::sort(layout.begin(), layout.end());
+  }
+  uint64_t nBytes = 0;
+  std::vector<AlObjectHeader*> copies;
+  for (auto obj : layout) {
+    auto size = objAllocSize(obj);
+    auto copy = (AlObjectHeader*)nvmBackend().reserve(size);
+    memcpy(copy, objHeader(obj), size);
+    relocation[obj] = copy + 1;
+    copies.push_back(copy);
+    nBytes += size;
+  }
+
+  for (auto copy : copies) {
+    for (auto field : pointerFields(copy + 1)) {
+      nvmPtrStore(field, relocation[nvmPtrLoad(field)]);
+    }
+    alPersist(copy, objAllocSize(copy + 1));
+    nvmBackend().activate(copy, nullptr, nullptr, nullptr, nullptr);
+  }
+
+  nvmPtrStore(root, relocation[rootObj]);
+  alPersist(root, sizeof(void*));
+
+  alGcVisitStackRoots([](void **slot, void *ctx) {
+    auto &relocation = *(std::map<void*, void*>*)ctx;
+    auto it = relocation.find(*slot);
+    if (it != relocation.end()) {
+      *slot = it->second;
+    }
+  }, &relocation);
+
+  for (auto obj : objs) {
+    objFree(obj);
+  }
+
+  std::vector<void*> objsAfter;
+  for (auto obj : objs) {
+    objsAfter.push_back(relocation[obj]);
+  }
+  cerr << "nvCompact: " << objs.size() << " objects, " << nBytes << " bytes, mean stride "
+       << strideBefore << " -> " << meanStride(objsAfter) << " bytes" << endl;
+}
+
+/**
+ * Garbage collector of the objects allocated by nvAllocObj.
+ * The collector enumerates the backend's allocations: the ones with GcObjectMagic
+ * are objects, traced through their type descriptors, every other one (persistent
+ * vars, nvAllocNBytes, rc objects) is a root and scanned conservatively word by word,
+ * as are the shadow stack frames. Unreached objects are freed.
+ * A cycle is incremental. Its start is one pause which snapshots the objects and
+ * shades the roots, afterwards every nvAllocObj marks AL_GC_STEP objects (256) and,
+ * once marking is done, lazily sweeps as many. Marking is snapshot at the beginning:
+ * while alGcMarking is set the write barrier shades the pointer a store overwrites,
+ * and objects allocated during the cycle are not in the snapshot, so they survive it.
+ * Programs compiled without --enable-gc-write-barrier run whole cycles instead.
+ * Whole cycles mark and sweep on AL_GC_THREADS threads (all cores by default): every
+ * thread marks from its own deque and steals from the others' when it runs dry, the
+ * sweep hands out chunks of the address ordered object table.
+ * Cycles start once AL_GC_TRIGGER_MB megabytes were allocated by nvAllocObj (never by
+ * default) or on gcCollect(). Both need the stack roots (--enable-gc-shadow-stack) and
+ * assume a single mutator thread. With AL_GC_ON_START=1 a whole cycle runs before
+ * AL__main, where the persistent roots are all there is, and reports its time.
+ * AL_GC_STATS=1 prints cycles and pauses at exit.
+ * A crash while sweeping at worst leaks the object being freed.
+ */
+struct AlGcStats {
+  uint64_t cycles;
+  uint64_t pauses;
+  uint64_t totalPauseNs;
+  uint64_t maxPauseNs;
+  uint64_t freedObjects;
+  uint64_t freedBytes;
+};
+
+enum GcPhase { GcIdle, GcMarking, GcSweeping };
+const size_t GcNoObject = SIZE_MAX;
+// objects a sweeping thread takes at once
+const size_t GcSweepChunk = 4096;
+
+// start and length in words of the allocations scanned as roots
+typedef std::vector<std::pair<uint64_t*, uint64_t>> GcRoots;
+
+struct GcState {
+  std::mutex mutex;
+  GcPhase phase = GcIdle;
+  // payloads of the objects in the snapshot, sorted, and their marks
+  std::vector<void*> objects;
+  std::unique_ptr<std::atomic<uint8_t>[]> marks;
+  std::vector<size_t> grey;
+  size_t sweepNext = 0;
+  // set by alGcSetup
+  bool shadowStack = false;
+  bool writeBarrier = false;
+  uint64_t triggerBytes = 0;
+  uint64_t stepObjects = 256;
+  unsigned threads = 1;
+  uint64_t allocatedBytes = 0;
+  AlGcStats stats = {};
+  AlHistogram pauses;
+};
+GcState gc;
+
+bool gcCycleInProgress() {
+  std::lock_guard<std::mutex> lock(gc.mutex);
+  return gc.phase != GcIdle;
+}
+
+bool isGcObject(void *ptr, uint64_t nBytes) {
+  auto header = (AlObjectHeader*)ptr;
+  return nBytes >= sizeof(AlObjectHeader) &&
+         (header->flags & GcObjectMagicMask) == GcObjectMagic &&
+         header->typeId < nTypeDescriptors &&
+         sizeof(AlObjectHeader) + typeDescriptors[header->typeId].size <= nBytes;
+}
+
+// Index of the snapshot object p points into, GcNoObject if there is none
+size_t gcFindObject(void *p) {
+  auto it = std::upper_bound(gc.objects.begin(), gc.objects.end(), p);
+  if (it == gc.objects.begin()) {
+    return GcNoObject;
+  }
+  auto obj = *(it - 1);
+  if ((char*)p >= (char*)obj + alGetTypeDescriptor(objHeader(obj)->typeId)->size) {
+    return GcNoObject;
+  }
+  return it - 1 - gc.objects.begin();
+}
+
+void gcShade(void *p, std::vector<size_t> &grey) {
+  auto i = gcFindObject(p);
+  if (i != GcNoObject && gc.marks[i].exchange(1) == 0) {
+    grey.push_back(i);
+  }
+}
+
+// A word that may be a pointer, absolute or relative to the pool
+void gcShadeWord(uint64_t v, std::vector<size_t> &grey) {
+  if (v == 0) {
+    return;
+  }
+  gcShade((void*)v, grey);
+  if (relativeNvmPtr) {
+    gcShade((char*)al_nvm_base + v, grey);
+  }
+}
+
+void gcScanObject(void *obj, std::vector<size_t> &grey) {
+  auto desc = alGetTypeDescriptor(objHeader(obj)->typeId);
+  auto words = (void**)obj;
+  for (uint64_t i = 0; i < (desc->size + 7) / 8; ++i) {
+    if (((desc->pointerBitmap[i / 64] >> (i % 64)) & 1) && words[i] != nullptr) {
+      gcShade(nvmPtrLoad(&words[i]), grey);
+    }
+  }
+}
+
+void gcShadeOverwritten(void **slot, void *oldVal, void *newVal) {
+  std::lock_guard<std::mutex> lock(gc.mutex);
+  if (gc.phase == GcMarking) {
+    gcShade(oldVal, gc.grey);
+  }
+}
+
+// Runtime functions overwriting an out parameter, which may be a field of an object
+void gcOutSlotBarrier(void **slot) {
+  if (!alGcMarking) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(gc.mutex);
+  if (gc.phase == GcMarking) {
+    gcShadeWord((uint64_t)*slot, gc.grey);
+  }
+}
+
+void gcRecordPause(uint64_t startCycles) {
+  auto ns = cyclesToNs(readCycles() - startCycles);
+  gc.stats.pauses++;
+  gc.stats.totalPauseNs += ns;
+  gc.stats.maxPauseNs = std::max<uint64_t>(gc.stats.maxPauseNs, ns);
+  histRecordValue(gc.pauses, ns);
+}
+
+// Fills the object table of a new cycle, returns the roots
+GcRoots gcSnapshot() {
+  GcRoots roots;
+  gc.objects.clear();
+  auto enumerated = nvmBackend().forEachAllocation([](void *ptr, uint64_t nBytes, void *ctx) {
+    if (isGcObject(ptr, nBytes)) {
+      gc.objects.push_back((AlObjectHeader*)ptr + 1);
+    } else {
+      ((GcRoots*)ctx)->emplace_back((uint64_t*)ptr, nBytes / 8);
+    }
+  }, &roots);
+  if (!enumerated) {
+    cerr << "gc: the " << nvmBackend().getName() << " backend cannot enumerate its allocations" << endl;
+    abort();
+  }
+  std::sort(gc.objects.begin(), gc.objects.end());
+  gc.marks.reset(new std::atomic<uint8_t>[gc.objects.size()]());
+  gc.grey.clear();
+  gc.stats.cycles++;
+  return roots;
+}
+
+void gcScanStackRoots(std::vector<size_t> &grey) {
+  alGcVisitStackRoots([](void **slot, void *ctx) {
+    gcShade(*slot, *(std::vector<size_t>*)ctx);
+  }, &grey);
+}
+
+void gcStartCycle() {
+  auto roots = gcSnapshot();
+  for (auto &root : roots) {
+    for (uint64_t i = 0; i < root.second; ++i) {
+      gcShadeWord(root.first[i], gc.grey);
+    }
+  }
+  gcScanStackRoots(gc.grey);
+
+  gc.phase = GcMarking;
+  if (gc.writeBarrier) {
+    alGcSetWriteBarrierHook(gcShadeOverwritten);
+    alGcSetMarking(1);
+  }
+}
+
+void gcFinishMarking() {
+  alGcSetMarking(0);
+  alGcSetWriteBarrierHook(nullptr);
+  gc.phase = GcSweeping;
+  gc.sweepNext = 0;
+}
+
+// Returns true once nothing is left to mark
+bool gcMarkStep(uint64_t nObjects) {
+  for (uint64_t n = 0; n < nObjects && !gc.grey.empty(); ++n) {
+    auto i = gc.grey.back();
+    gc.grey.pop_back();
+    gcScanObject(gc.objects[i], gc.grey);
+  }
+  if (!gc.grey.empty()) {
+    return false;
+  }
+  gcFinishMarking();
+  return true;
+}
+
+/**
+ * Mark deque of one marking thread. The owner pushes and pops at the back,
+ * idle threads steal half of it from the front.
+ */
+struct GcMarkDeque {
+  std::mutex mutex;
+  std::deque<size_t> items;
+  std::atomic<size_t> size{0};
+};
+
+struct GcParallelMark {
+  std::vector<std::unique_ptr<GcMarkDeque>> deques;
+  std::atomic<unsigned> idle{0};
+  // roots are handed out in pieces of at most GcRootPiece words,
+  // rootPieces[r] is the number of pieces before root r
+  const GcRoots *roots;
+  std::vector<size_t> rootPieces;
+  std::atomic<size_t> nextPiece{0};
+};
+const uint64_t GcRootPiece = 64 * 1024;
+
+void gcPushGrey(GcMarkDeque &deque, std::vector<size_t> &found) {
+  if (found.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(deque.mutex);
+  deque.items.insert(deque.items.end(), found.begin(), found.end());
+  deque.size.store(deque.items.size(), std::memory_order_relaxed);
+  found.clear();
+}
+
+bool gcPopGrey(GcMarkDeque &deque, size_t &i) {
+  std::lock_guard<std::mutex> lock(deque.mutex);
+  if (deque.items.empty()) {
+    return false;
+  }
+  i = deque.items.back();
+  deque.items.pop_back();
+  deque.size.store(deque.items.size(), std::memory_order_relaxed);
+  return true;
+}
+
+bool gcStealGrey(GcParallelMark &mark, unsigned self) {
+  auto n = mark.deques.size();
+  for (size_t k = 1; k < n; ++k) {
+    auto &victim = *mark.deques[(self + k) % n];
+    if (victim.size.load(std::memory_order_relaxed) == 0) {
+      continue;
+    }
+    std::vector<size_t> stolen;
+    {
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      auto half = (victim.items.size() + 1) / 2;
+      stolen.assign(victim.items.begin(), victim.items.begin() + half);
+      victim.items.erase(victim.items.begin(), victim.items.begin() + half);
+      victim.size.store(victim.items.size(), std::memory_order_relaxed);
+    }
+    if (!stolen.empty()) {
+      gcPushGrey(*mark.deques[self], stolen);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool gcAnyGrey(GcParallelMark &mark) {
+  for (auto &deque : mark.deques) {
+    if (deque->size.load(std::memory_order_relaxed) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void gcMarkWorker(GcParallelMark &mark, unsigned self) {
+  auto &own = *mark.deques[self];
+  std::vector<size_t> found;
+  auto &roots = *mark.roots;
+  // roots first, split so one large allocation does not end up on a single thread
+  for (;;) {
+    auto piece = mark.nextPiece.fetch_add(1);
+    if (piece >= mark.rootPieces.back()) {
+      break;
+    }
+    auto r = std::upper_bound(mark.rootPieces.begin(), mark.rootPieces.end(), piece) - mark.rootPieces.begin() - 1;
+    auto first = (piece - mark.rootPieces[r]) * GcRootPiece;
+    auto end = std::min(roots[r].second, first + GcRootPiece);
+    for (auto w = first; w < end; ++w) {
+      gcShadeWord(roots[r].first[w], found);
+    }
+    gcPushGrey(own, found);
+  }
+
+  // every thread but the ones that went idle may still produce grey objects
+  for (;;) {
+    size_t i;
+    if (gcPopGrey(own, i)) {
+      gcScanObject(gc.objects[i], found);
+      gcPushGrey(own, found);
+      continue;
+    }
+    if (gcStealGrey(mark, self)) {
+      continue;
+    }
+    mark.idle++;
+    for (;;) {
+      if (mark.idle.load() == mark.deques.size()) {
+        return;
+      }
+      if (gcAnyGrey(mark)) {
+        mark.idle--;
+        break;
+      }
+      std::this_thread::yield();
+    }
+  }
+}
+
+// Marks from the roots and the grey objects so far on gc.threads threads
+void gcMarkParallel(const GcRoots &roots) {
+  GcParallelMark mark;
+  mark.roots = &roots;
+  mark.rootPieces.push_back(0);
+  for (auto &root : roots) {
+    mark.rootPieces.push_back(mark.rootPieces.back() + (root.second + GcRootPiece - 1) / GcRootPiece);
+  }
+  for (unsigned t = 0; t < gc.threads; ++t) {
+    mark.deques.emplace_back(new GcMarkDeque);
+  }
+  gcPushGrey(*mark.deques[0], gc.grey);
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < gc.threads; ++t) {
+    threads.emplace_back(gcMarkWorker, std::ref(mark), t);
+  }
+  gcMarkWorker(mark, 0);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  gcFinishMarking();
+}
+
+void gcSweepStep(uint64_t nObjects) {
+  auto end = std::min<uint64_t>(gc.sweepNext + nObjects, gc.objects.size());
+  for (; gc.sweepNext < end; ++gc.sweepNext) {
+    auto obj = gc.objects[gc.sweepNext];
+    if (!gc.marks[gc.sweepNext].load(std::memory_order_relaxed)) {
+      gc.stats.freedObjects++;
+      gc.stats.freedBytes += objAllocSize(obj);
+      objFree(obj);
+    }
+  }
+  if (gc.sweepNext == gc.objects.size()) {
+    gc.phase = GcIdle;
+    std::vector<void*>().swap(gc.objects);
+    gc.marks.reset();
+  }
+}
+
+void gcSweepParallel() {
+  std::atomic<size_t> nextChunk{gc.sweepNext / GcSweepChunk};
+  std::atomic<uint64_t> freedObjects{0}, freedBytes{0};
+  auto sweep = [&]() {
+    uint64_t objects = 0, bytes = 0;
+    for (;;) {
+      auto first = std::max(nextChunk.fetch_add(1) * GcSweepChunk, gc.sweepNext);
+      if (first >= gc.objects.size()) {
+        break;
+      }
+      auto end = std::min(first + GcSweepChunk, gc.objects.size());
+      for (auto i = first; i < end; ++i) {
+        if (!gc.marks[i].load(std::memory_order_relaxed)) {
+          objects++;
+          bytes += objAllocSize(gc.objects[i]);
+          objFree(gc.objects[i]);
+        }
+      }
+    }
+    freedObjects += objects;
+    freedBytes += bytes;
+  };
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < gc.threads; ++t) {
+    threads.emplace_back(sweep);
+  }
+  sweep();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  gc.stats.freedObjects += freedObjects;
+  gc.stats.freedBytes += freedBytes;
+  gc.sweepNext = gc.objects.size();
+  gcSweepStep(0);
+}
+
+// Starts or finishes a cycle in one pause
+void gcCollectLocked() {
+  auto start = readCycles();
+  if (gc.phase == GcIdle) {
+    auto roots = gcSnapshot();
+    gcScanStackRoots(gc.grey);
+    gcMarkParallel(roots);
+  } else if (gc.phase == GcMarking) {
+    gcMarkParallel(GcRoots());
+  }
+  gcSweepParallel();
+  gc.allocatedBytes = 0;
+  gcRecordPause(start);
+}
+
+void gcAllocationStep(uint64_t nBytes) {
+  // the trigger is set once before AL__main
+  if (gc.triggerBytes == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(gc.mutex);
+  gc.allocatedBytes += nBytes;
+  if (gc.phase == GcIdle && gc.allocatedBytes < gc.triggerBytes) {
+    return;
+  }
+  if (!gc.writeBarrier) {
+    gcCollectLocked();
+    return;
+  }
+  auto start = readCycles();
+  if (gc.phase == GcIdle) {
+    gc.allocatedBytes = 0;
+    gcStartCycle();
+  } else if (gc.phase == GcMarking) {
+    gcMarkStep(gc.stepObjects);
+  } else {
+    gcSweepStep(gc.stepObjects);
+  }
+  gcRecordPause(start);
+}
+
+// Whole cycle before AL__main, nothing but the pool refers to objects yet
+void gcRestartCollection() {
+  std::lock_guard<std::mutex> lock(gc.mutex);
+  auto start = std::chrono::steady_clock::now();
+  auto freedBefore = gc.stats.freedObjects;
+  gcCollectLocked();
+  auto ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+  // nvAllocObj objects only, the table is gone after the sweep
+  uint64_t live = 0;
+  nvmBackend().forEachAllocation([](void *ptr, uint64_t nBytes, void *ctx) {
+    *(uint64_t*)ctx += isGcObject(ptr, nBytes) ? 1 : 0;
+  }, &live);
+  cerr << "gc restart: " << live + gc.stats.freedObjects - freedBefore << " objects, " << live << " live, "
+       << ms << " ms, " << gc.threads << " threads" << endl;
+}
+
+// Called before AL__main with the gc options the program was compiled with
+DLLEXPORT void alGcSetup(int32_t shadowStack, int32_t writeBarrier) {
+  gc.shadowStack = shadowStack != 0;
+  gc.writeBarrier = writeBarrier != 0;
+  gc.stepObjects = std::max<uint64_t>(envUint64("AL_GC_STEP", 256), 1);
+  gc.threads = (unsigned)std::max<uint64_t>(envUint64("AL_GC_THREADS", std::thread::hardware_concurrency()), 1);
+  gc.triggerBytes = envUint64("AL_GC_TRIGGER_MB", 0) * 1024 * 1024;
+  if (gc.triggerBytes != 0 && !gc.shadowStack) {
+    cerr << "AL_GC_TRIGGER_MB needs a program compiled with --enable-gc-shadow-stack" << endl;
+    abort();
+  }
+  if (envUint64("AL_GC_ON_START", 0)) {
+    gcRestartCollection();
+  }
+}
+
+// Runs a whole cycle, or finishes the one in progress
+DLLEXPORT void gcCollect() {
+  if (!gc.shadowStack) {
+    cerr << "gcCollect needs a program compiled with --enable-gc-shadow-stack" << endl;
+    abort();
+  }
+  std::lock_guard<std::mutex> lock(gc.mutex);
+  gcCollectLocked();
+}
+
+DLLEXPORT void alGcGetStats(AlGcStats *stats) {
+  std::lock_guard<std::mutex> lock(gc.mutex);
+  *stats = gc.stats;
+}
+
+DLLEXPORT void gcDump() {
+  std::lock_guard<std::mutex> lock(gc.mutex);
+  auto &stats = gc.stats;
+  cerr << "gc: cycles " << stats.cycles << ", freed " << stats.freedObjects << " objects "
+       << stats.freedBytes << " bytes, pauses " << stats.pauses;
+  if (stats.pauses > 0) {
+    cerr << ", mean " << stats.totalPauseNs / stats.pauses
+         << ", p50 " << histPercentile(gc.pauses, stats.pauses, 50)
+         << ", p99 " << histPercentile(gc.pauses, stats.pauses, 99)
+         << ", max " << stats.maxPauseNs << " ns";
+  }
+  cerr << endl;
+}
+
+DLLEXPORT void rcAlloc(void **pp, uint32_t typeId) {
+  auto desc = alGetTypeDescriptor(typeId);
+  void *rel = nullptr;
+  auto ptr = (AlRcHeader*)nvmBackend().reserve(sizeof(AlRcHeader) + desc->size);
+  memset(ptr + 1, 0, desc->size);
+  ptr->count = 1;
+  ptr->typeId = typeId;
+  ptr->flags = 0;
+  alPersist(ptr, sizeof(AlRcHeader) + desc->size);
+  nvmBackend().activate(ptr, &rel, ptr + 1, nullptr, nullptr);
+
+  // the reference held by *pp is replaced
+  rcLog(*pp, -1);
+  *pp = nvmBackend().abs(rel);
+}
+
+// Initial value of rc variables
+DLLEXPORT void *rcNull() {
+  return nullptr;
+}
+
+DLLEXPORT void alRcInc(void *obj) {
+  rcLog(obj, 1);
+}
+
+DLLEXPORT void alRcDec(void *obj) {
+  rcLog(obj, -1);
+}
+
+// Apply this thread's log and free what is no longer referenced
+DLLEXPORT void rcEpoch() {
+  rcAdvanceEpoch();
+}
+
+DLLEXPORT void alRegionEnter() {
+  regionStack.emplace_back();
+}
+
+DLLEXPORT void alRegionLeave(int n) {
+  for (int i = 0; i < n; ++i) {
+    if (regionStack.empty()) {
+      cerr << "leaving a region without entering it" << endl;
+      abort();
+    }
+    auto &region = regionStack.back();
+    for (auto chunk : region.chunks) {
+      freeRegionChunks.push_back(chunk);
+    }
+    for (auto chunk : region.largeChunks) {
+      free(chunk);
+    }
+    regionStack.pop_back();
+  }
+}
+
+DLLEXPORT void *vAlloc(uint32_t nBytes) {
+  return regionAlloc(nBytes);
+}
+DLLEXPORT void vAllocNBytes(int **i32, uint32_t nBytes) {
+  *i32 = (int*)regionAlloc(nBytes);
 }
 
 DLLEXPORT int thread(void (*thread_fn)(int), int val) {
-  std::thread t([&thread_fn, val]() -> void {
+  // Threads are spread over the NUMA nodes, their persistent allocations come from
+  // their node's pool and region chunks are first touched there
+  int node = numaTopology().getNodeCount() > 1 ? numaNextNode() : -1;
+  std::thread t([thread_fn, val, node]() -> void {
+    if (node >= 0) {
+      numaPinThread(node);
+    }
     thread_fn(val);
   });
   t.detach();
   return 0;
 }
 
-DLLEXPORT int *tic() {
-  auto tp = std::chrono::high_resolution_clock::now();
-  auto ptp = new decltype(tp)(tp);
-  return (int*)ptp;
+// The TSC value, nothing is allocated
+DLLEXPORT int64_t tic() {
+  return (int64_t)readCycles();
+}
+
+DLLEXPORT int64_t toc64(int64_t ticVal) {
+  return cyclesToNs(readCycles() - (uint64_t)ticVal);
 }
-DLLEXPORT int toc(int *ticVal) {
-  auto end = chrono::high_resolution_clock::now();
-  auto start = (decltype(end)*)ticVal;
-  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - *start).count();
-  delete start;
-  return (int)ns;
+
+// Saturates at INT32_MAX (about 2s), use toc64 for longer intervals
+DLLEXPORT int toc(int64_t ticVal) {
+  return (int)std::min<int64_t>(toc64(ticVal), INT32_MAX);
+}
+
+DLLEXPORT void putsInt64(int64_t i) {
+  cout << i << endl;
+}
+
+DLLEXPORT void timerStart(int32_t id) {
+  histogram(id);
+  timerStarts[id] = readCycles();
+}
+
+// Returns the nanoseconds since timerStart(id) of this thread and records them in histogram id
+DLLEXPORT int64_t timerStop(int32_t id) {
+  auto &hist = histogram(id);
+  auto ns = cyclesToNs(readCycles() - timerStarts[id]);
+  histRecordValue(hist, ns);
+  return ns;
+}
+
+DLLEXPORT void histRecord(int32_t id, int64_t value) {
+  histRecordValue(histogram(id), value);
+}
+
+DLLEXPORT void histReset(int32_t id) {
+  auto &hist = histogram(id);
+  for (auto &bucket : hist.buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  hist.count.store(0);
+  hist.total.store(0);
+  hist.max.store(0);
+}
+
+DLLEXPORT void histDump(int32_t id) {
+  auto &hist = histogram(id);
+  auto count = hist.count.load();
+  cout << "histogram " << id << ": n " << count;
+  if (count > 0) {
+    cout << ", mean " << hist.total.load() / count
+         << ", p50 " << histPercentile(hist, count, 50)
+         << ", p90 " << histPercentile(hist, count, 90)
+         << ", p99 " << histPercentile(hist, count, 99)
+         << ", p99.9 " << histPercentile(hist, count, 99.9)
+         << ", max " << hist.max.load();
+  }
+  cout << endl;
 }
 
 
@@ -0,0 +1,124 @@
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "numa.h"
+
+using namespace std;
+
+namespace {
+
+const int MpolPreferred = 1;
+
+// "0-3,8-11" -> 0 1 2 3 8 9 10 11
+vector<int> parseCpuList(const string &list) {
+  vector<int> cpus;
+  stringstream ss(list);
+  string range;
+  while (getline(ss, range, ',')) {
+    if (range.empty() || range == "\n") {
+      continue;
+    }
+    auto dash = range.find('-');
+    int first = stoi(range.substr(0, dash));
+    int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+NumaTopology readTopology() {
+  NumaTopology topology;
+  int nCpus = max(1u, std::thread::hardware_concurrency());
+
+  auto emulatedNodes = getenv("AL_NUMA_NODES");
+  if (emulatedNodes && *emulatedNodes) {
+    int nNodes = max(1, atoi(emulatedNodes));
+    topology.emulated = true;
+    topology.nodeCpus.resize(nNodes);
+    for (int cpu = 0; cpu < nCpus; ++cpu) {
+      topology.nodeCpus[cpu * nNodes / nCpus].push_back(cpu);
+    }
+    return topology;
+  }
+
+  for (int node = 0; ; ++node) {
+    ifstream in("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+    if (!in) {
+      break;
+    }
+    string list;
+    getline(in, list);
+    topology.nodeCpus.push_back(parseCpuList(list));
+  }
+  if (topology.nodeCpus.empty()) {
+    topology.nodeCpus.emplace_back();
+    for (int cpu = 0; cpu < nCpus; ++cpu) {
+      topology.nodeCpus[0].push_back(cpu);
+    }
+  }
+  return topology;
+}
+
+thread_local int pinnedNode = -1;
+std::atomic<int> nextNode(0);
+
+}
+
+const NumaTopology &numaTopology() {
+  static NumaTopology topology = readTopology();
+  return topology;
+}
+
+int numaCurrentNode() {
+  if (pinnedNode >= 0) {
+    return pinnedNode;
+  }
+  auto &topology = numaTopology();
+  int cpu = sched_getcpu();
+  for (int node = 0; node < topology.getNodeCount(); ++node) {
+    for (auto nodeCpu : topology.nodeCpus[node]) {
+      if (nodeCpu == cpu) {
+        return node;
+      }
+    }
+  }
+  return 0;
+}
+
+void numaPinThread(int node) {
+  auto &cpus = numaTopology().nodeCpus[node];
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+    cerr << "cannot pin thread to numa node " << node << endl;
+  }
+  pinnedNode = node;
+}
+
+int numaNextNode() {
+  return nextNode++ % numaTopology().getNodeCount();
+}
+
+void numaBindMemory(void *addr, unsigned long len, int node) {
+  if (numaTopology().emulated || numaTopology().getNodeCount() == 1) {
+    return;
+  }
+  unsigned long mask = 1UL << node;
+  // raw mbind, so the runtime does not depend on libnuma
+  if (syscall(SYS_mbind, addr, len, MpolPreferred, &mask, sizeof(mask) * 8, 0) != 0) {
+    cerr << "mbind to numa node " << node << " failed" << endl;
+  }
+}
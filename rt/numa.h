@@ -0,0 +1,23 @@
+#pragma once
+#include <vector>
+
+/**
+ * NUMA topology of the machine, read from /sys/devices/system/node.
+ * AL_NUMA_NODES=n emulates n nodes by splitting the CPUs evenly, so per node
+ * pools and thread placement can be tested on single node machines.
+ */
+struct NumaTopology {
+  std::vector<std::vector<int>> nodeCpus;
+  bool emulated = false;
+  int getNodeCount() const { return (int)nodeCpus.size(); }
+};
+
+const NumaTopology &numaTopology();
+// Node of the calling thread, the one it is pinned to or the one it runs on
+int numaCurrentNode();
+// Restricts the calling thread to the CPUs of node
+void numaPinThread(int node);
+// Node for the next thread started by thread(), round robin
+int numaNextNode();
+// Prefer node for the pages of [addr, addr + len), does nothing on emulated topologies
+void numaBindMemory(void *addr, unsigned long len, int node);
@@ -0,0 +1,679 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+#include "../nvm_malloc/src/nvm_malloc.h"
+#ifdef AL_WITH_PMEMOBJ
+#include <libpmemobj.h>
+#endif
+#include "nvm_backend.h"
+#include "numa.h"
+
+using namespace std;
+
+namespace {
+
+const uint64_t CacheLineSize = 64;
+const uint64_t HugePageSize = 2 * 1024 * 1024;
+
+uint64_t poolSizeFromEnv() {
+  auto s = getenv("AL_NVM_POOL_SIZE_MB");
+  uint64_t mb = s && *s ? strtoull(s, nullptr, 10) : 1024;
+  return mb * 1024 * 1024;
+}
+
+/**
+ * Mapping options of the mmap pool
+ *   AL_NVM_HUGEPAGES  explicit: MAP_HUGETLB (AL_NVM_PATH on hugetlbfs),
+ *                     thp: transparent huge page advice (tmpfs/DAX)
+ *   AL_NVM_PREFAULT   populate: fault in the whole pool,
+ *                     parallel: AL_NVM_PREFAULT_THREADS threads touch the used part
+ *   AL_NVM_MADVISE    willneed, random or sequential
+ */
+struct MappingOptions {
+  string hugepages;
+  string prefault;
+  string advice;
+  unsigned prefaultThreads;
+
+  static MappingOptions fromEnv() {
+    auto env = [](const char *name) -> string {
+      auto s = getenv(name);
+      return s ? s : "";
+    };
+    MappingOptions options;
+    options.hugepages = env("AL_NVM_HUGEPAGES");
+    options.prefault = env("AL_NVM_PREFAULT");
+    options.advice = env("AL_NVM_MADVISE");
+    auto threads = env("AL_NVM_PREFAULT_THREADS");
+    options.prefaultThreads = threads.empty() ? std::max(1u, std::thread::hardware_concurrency()) : (unsigned)stoul(threads);
+    return options;
+  }
+};
+
+/**
+ * Touch one byte per page from several threads, so the faults are taken in parallel.
+ * A read fault of a shared mapping maps the page read only and the first store faults
+ * again, so the byte is written: an atomic add of 0 keeps its content.
+ */
+void prefaultParallel(char *p, uint64_t nBytes, uint64_t pageSize, unsigned nThreads) {
+  std::vector<std::thread> threads;
+  auto nPages = (nBytes + pageSize - 1) / pageSize;
+  for (unsigned t = 0; t < nThreads; ++t) {
+    threads.emplace_back([=]() {
+      for (auto page = t; page < nPages; page += nThreads) {
+        __atomic_fetch_add(p + page * pageSize, 0, __ATOMIC_RELAXED);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+#if defined(__x86_64__)
+void flushLinesClflush(uintptr_t first, uintptr_t end) {
+  for (auto p = first; p < end; p += CacheLineSize) {
+    _mm_clflush((const void*)p);
+  }
+}
+
+__attribute__((target("clflushopt")))
+void flushLinesClflushopt(uintptr_t first, uintptr_t end) {
+  for (auto p = first; p < end; p += CacheLineSize) {
+    _mm_clflushopt((void*)p);
+  }
+}
+
+// clwb writes the line back without evicting it, later loads still hit
+__attribute__((target("clwb")))
+void flushLinesClwb(uintptr_t first, uintptr_t end) {
+  for (auto p = first; p < end; p += CacheLineSize) {
+    _mm_clwb((void*)p);
+  }
+}
+
+/**
+ * The best flush instruction of the CPU: clwb, clflushopt, then clflush.
+ * AL_NVM_FLUSH=clflush|clflushopt|clwb overrides it, e.g. to compare them.
+ */
+void (*selectFlushLines())(uintptr_t, uintptr_t) {
+  unsigned eax, ebx = 0, ecx, edx;
+  __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+  bool hasClflushopt = ebx & (1u << 23);
+  bool hasClwb = ebx & (1u << 24);
+  auto s = getenv("AL_NVM_FLUSH");
+  string forced = s ? s : "";
+  if (forced == "clflush") {
+    return flushLinesClflush;
+  }
+  if ((forced.empty() || forced == "clwb") && hasClwb) {
+    return flushLinesClwb;
+  }
+  if ((forced.empty() || forced == "clwb" || forced == "clflushopt") && hasClflushopt) {
+    return flushLinesClflushopt;
+  }
+  if (!forced.empty() && forced != "clflushopt" && forced != "clwb") {
+    cerr << "unknown AL_NVM_FLUSH " << forced << ", using clflush" << endl;
+  }
+  return flushLinesClflush;
+}
+#endif
+
+void flushRange(const void *ptr, uint64_t nBytes) {
+#if defined(__x86_64__)
+  static auto flushLines = selectFlushLines();
+  flushLines((uintptr_t)ptr & ~(CacheLineSize - 1), (uintptr_t)ptr + nBytes);
+  _mm_sfence();
+#else
+  __sync_synchronize();
+#endif
+}
+
+class NvmMallocBackend :public NvmBackend {
+public:
+  const char *getName() const override { return "nvm_malloc"; }
+  void initialize(const char *path, bool recover) override { nvm_initialize(path, recover); }
+  void *reserve(uint64_t nBytes) override { return nvm_reserve(nBytes); }
+  void *reserveId(const char *id, uint64_t nBytes) override { return nvm_reserve_id(id, nBytes); }
+  void activate(void *ptr, void **linkPtr1, void *target1, void **linkPtr2, void *target2) override {
+    nvm_activate(ptr, linkPtr1, target1, linkPtr2, target2);
+  }
+  void activateId(const char *id) override { nvm_activate_id(id); }
+  void *getId(const char *id) override { return nvm_get_id(id); }
+  void free(void *ptr, void **linkPtr1, void *target1, void **linkPtr2, void *target2) override {
+    nvm_free(ptr, linkPtr1, target1, linkPtr2, target2);
+  }
+  void persist(const void *ptr, uint64_t nBytes) override { nvm_persist(ptr, nBytes); }
+  void *abs(void *relPtr) override { return nvm_abs(relPtr); }
+};
+
+/**
+ * Pool files mapped with MAP_SHARED, AL_NVM_POOL_SIZE_MB large each (1GB by default).
+ * The size is kept in the pool header, reopened pools keep it whatever the variable says.
+ * There is one pool per NUMA node, mapped next to each other so pointers relative
+ * to the first one work across all of them. Threads allocate from their node's pool,
+ * named ids live in the first one.
+ * Blocks are bump allocated and recycled through per size free lists, every block
+ * has a header with its size and state. Free lists are volatile, they are rebuilt
+ * by scanning the blocks on start up, which also reclaims reserved blocks.
+ * Activation persists the block state before the links: a crash in between leaks
+ * the block, it never publishes an unactivated one.
+ */
+class MmapBackend :public NvmBackend {
+  enum BlockState : uint64_t { Free = 0, Reserved = 1, Active = 2 };
+  struct BlockHeader {
+    uint64_t size;
+    uint64_t state;
+  };
+  static const uint64_t MaxIds = 1024;
+  static const uint64_t IdLength = 48;
+  struct IdEntry {
+    char name[IdLength];
+    // relative to the first pool
+    uint64_t offset;
+    uint64_t state;
+  };
+  static const uint64_t Magic = 0x6c6f6f706c61ULL; // "alpool"
+  struct PoolHeader {
+    uint64_t magic;
+    uint64_t size;
+    uint64_t top;
+    IdEntry ids[MaxIds];
+  };
+  struct Pool {
+    char *start;
+    PoolHeader *header;
+    std::mutex mutex;
+    std::map<uint64_t, std::vector<uint64_t>> freeLists;
+  };
+
+public:
+  const char *getName() const override { return "mmap"; }
+
+  void initialize(const char *path, bool recover) override {
+    mkdir(path, 0755);
+    poolSize = poolSizeFromEnv();
+    // the pools of other nodes are placed by the size, an existing pool keeps its own
+    auto storedSize = recover ? readPoolSize(string(path) + "/al.pool") : 0;
+    if (storedSize != 0 && storedSize != poolSize) {
+      if (getenv("AL_NVM_POOL_SIZE_MB") != nullptr) {
+        cerr << "nvm pool '" << path << "' was created with " << storedSize / (1024 * 1024)
+             << "MB, ignoring AL_NVM_POOL_SIZE_MB" << endl;
+      }
+      poolSize = storedSize;
+    }
+    auto options = MappingOptions::fromEnv();
+    auto nNodes = numaTopology().getNodeCount();
+    // MAP_HUGETLB needs huge page aligned addresses and lengths, so every pool starts on one
+    if (storedSize == 0) {
+      poolSize = (poolSize + HugePageSize - 1) & ~(HugePageSize - 1);
+    } else if (options.hugepages == "explicit" && poolSize % HugePageSize != 0) {
+      cerr << "nvm pool '" << path << "' is not a multiple of 2MB, it cannot be mapped with huge pages" << endl;
+      abort();
+    }
+
+    // one address range for all pools, the files are mapped into it
+    auto reserved = (char*)mmap(nullptr, poolSize * nNodes + HugePageSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED) {
+      cerr << "cannot reserve address space for the nvm pools" << endl;
+      abort();
+    }
+    base = (char*)(((uintptr_t)reserved + HugePageSize - 1) & ~(HugePageSize - 1));
+    for (int node = 0; node < nNodes; ++node) {
+      auto file = string(path) + "/al.pool" + (node == 0 ? "" : "." + to_string(node));
+      pools.emplace_back(new Pool);
+      mapPool(*pools.back(), file, base + node * poolSize, node, options, recover);
+    }
+  }
+
+  void *reserve(uint64_t nBytes) override {
+    auto &pool = *pools[numaCurrentNode() % pools.size()];
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    return reserveLocked(pool, nBytes);
+  }
+
+  void *reserveId(const char *id, uint64_t nBytes) override {
+    auto &pool = *pools[0];
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (strlen(id) >= IdLength) {
+      cerr << "nvm id too long '" << id << "'" << endl;
+      abort();
+    }
+    for (auto &entry : pool.header->ids) {
+      if (entry.state == Free) {
+        auto p = (char*)reserveLocked(pool, nBytes);
+        strcpy(entry.name, id);
+        entry.offset = p - base;
+        entry.state = Reserved;
+        persist(&entry, sizeof(entry));
+        return p;
+      }
+    }
+    cerr << "too many nvm ids" << endl;
+    abort();
+  }
+
+  void activate(void *ptr, void **linkPtr1, void *target1, void **linkPtr2, void *target2) override {
+    auto block = blockOf(ptr);
+    block->state = Active;
+    persist(&block->state, sizeof(block->state));
+    setLinks(linkPtr1, target1, linkPtr2, target2);
+  }
+
+  void activateId(const char *id) override {
+    std::lock_guard<std::mutex> lock(pools[0]->mutex);
+    auto entry = findId(id);
+    if (entry == nullptr) {
+      cerr << "nvm id not found '" << id << "'" << endl;
+      abort();
+    }
+    auto block = blockOf(base + entry->offset);
+    block->state = Active;
+    persist(&block->state, sizeof(block->state));
+    entry->state = Active;
+    persist(&entry->state, sizeof(entry->state));
+  }
+
+  void *getId(const char *id) override {
+    std::lock_guard<std::mutex> lock(pools[0]->mutex);
+    auto entry = findId(id);
+    return entry ? base + entry->offset : nullptr;
+  }
+
+  void free(void *ptr, void **linkPtr1, void *target1, void **linkPtr2, void *target2) override {
+    auto block = blockOf(ptr);
+    block->state = Free;
+    persist(&block->state, sizeof(block->state));
+    setLinks(linkPtr1, target1, linkPtr2, target2);
+    // back to the pool it came from
+    auto &pool = *pools[((char*)block - base) / poolSize];
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.freeLists[block->size].push_back((char*)block - pool.start);
+  }
+
+  void persist(const void *ptr, uint64_t nBytes) override {
+    flushRange(ptr, nBytes);
+  }
+
+  void *abs(void *relPtr) override {
+    return base + (uintptr_t)relPtr;
+  }
+
+  bool forEachAllocation(AllocationVisitor visit, void *ctx) override {
+    for (auto &pool : pools) {
+      std::lock_guard<std::mutex> lock(pool->mutex);
+      for (auto offset = alignUp(sizeof(PoolHeader)); offset < pool->header->top;) {
+        auto block = (BlockHeader*)(pool->start + offset);
+        if (block->state != Free) {
+          visit(block + 1, block->size - sizeof(BlockHeader), ctx);
+        }
+        offset += block->size;
+      }
+    }
+    return true;
+  }
+
+private:
+  // Size in the header of an existing pool file, 0 if there is none
+  static uint64_t readPoolSize(const string &file) {
+    uint64_t header[2] = {0, 0};
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return 0;
+    }
+    auto n = pread(fd, header, sizeof(header), 0);
+    close(fd);
+    return n == sizeof(header) && header[0] == Magic ? header[1] : 0;
+  }
+
+  void mapPool(Pool &pool, const string &file, char *at, int node, const MappingOptions &options, bool recover) {
+    auto storedSize = recover ? readPoolSize(file) : 0;
+    if (storedSize != 0 && storedSize != poolSize) {
+      cerr << "nvm pool '" << file << "' has size " << storedSize << ", expected " << poolSize << endl;
+      abort();
+    }
+    int fd = open(file.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, poolSize) != 0) {
+      cerr << "cannot create nvm pool '" << file << "'" << endl;
+      abort();
+    }
+    int flags = MAP_SHARED | MAP_FIXED;
+    uint64_t pageSize = 4096;
+    if (options.hugepages == "explicit") {
+      flags |= MAP_HUGETLB;
+      pageSize = HugePageSize;
+    }
+    // populate after binding the range to its node
+    pool.start = (char*)mmap(at, poolSize, PROT_READ | PROT_WRITE, flags, fd, 0);
+    close(fd);
+    if (pool.start == MAP_FAILED) {
+      cerr << "cannot map nvm pool '" << file << "'" << endl;
+      abort();
+    }
+    numaBindMemory(pool.start, poolSize, node);
+    adviseMapping(pool.start, options);
+
+    pool.header = (PoolHeader*)pool.start;
+    auto header = pool.header;
+    if (header->magic != Magic || !recover) {
+      memset(header, 0, sizeof(PoolHeader));
+      header->size = poolSize;
+      header->top = alignUp(sizeof(PoolHeader));
+      persist(header, sizeof(PoolHeader));
+      header->magic = Magic;
+      persist(&header->magic, sizeof(header->magic));
+    }
+    recoverBlocks(pool);
+    if (options.prefault == "populate") {
+      prefaultParallel(pool.start, poolSize, pageSize, 1);
+    } else if (options.prefault == "parallel") {
+      prefaultParallel(pool.start, header->top, pageSize, options.prefaultThreads);
+    }
+  }
+
+  void adviseMapping(char *start, const MappingOptions &options) {
+    if (options.hugepages == "thp") {
+#ifdef MADV_HUGEPAGE
+      madvise(start, poolSize, MADV_HUGEPAGE);
+#endif
+    } else if (!options.hugepages.empty() && options.hugepages != "explicit") {
+      cerr << "unknown AL_NVM_HUGEPAGES '" << options.hugepages << "'" << endl;
+      abort();
+    }
+    if (options.advice == "willneed") {
+      madvise(start, poolSize, MADV_WILLNEED);
+    } else if (options.advice == "random") {
+      madvise(start, poolSize, MADV_RANDOM);
+    } else if (options.advice == "sequential") {
+      madvise(start, poolSize, MADV_SEQUENTIAL);
+    } else if (!options.advice.empty()) {
+      cerr << "unknown AL_NVM_MADVISE '" << options.advice << "'" << endl;
+      abort();
+    }
+    if (!options.prefault.empty() && options.prefault != "populate" && options.prefault != "parallel") {
+      cerr << "unknown AL_NVM_PREFAULT '" << options.prefault << "'" << endl;
+      abort();
+    }
+  }
+
+  static uint64_t alignUp(uint64_t n) {
+    return (n + sizeof(BlockHeader) - 1) & ~(sizeof(BlockHeader) - 1);
+  }
+
+  // Power of two sizes up to a page, then whole pages
+  static uint64_t blockSize(uint64_t nBytes) {
+    auto size = alignUp(nBytes + sizeof(BlockHeader));
+    if (size > 4096) {
+      return (size + 4095) & ~4095ULL;
+    }
+    uint64_t classSize = 32;
+    while (classSize < size) {
+      classSize <<= 1;
+    }
+    return classSize;
+  }
+
+  BlockHeader *blockOf(void *ptr) {
+    return (BlockHeader*)ptr - 1;
+  }
+
+  void *reserveLocked(Pool &pool, uint64_t nBytes) {
+    auto size = blockSize(nBytes);
+    auto header = pool.header;
+    auto &freeList = pool.freeLists[size];
+    BlockHeader *block;
+    if (!freeList.empty()) {
+      block = (BlockHeader*)(pool.start + freeList.back());
+      freeList.pop_back();
+    } else {
+      if (header->top + size > header->size) {
+        cerr << "nvm pool exhausted, set AL_NVM_POOL_SIZE_MB" << endl;
+        abort();
+      }
+      block = (BlockHeader*)(pool.start + header->top);
+      block->size = size;
+      header->top += size;
+    }
+    block->state = Reserved;
+    persist(block, sizeof(BlockHeader));
+    persist(&header->top, sizeof(header->top));
+    return block + 1;
+  }
+
+  void setLinks(void **linkPtr1, void *target1, void **linkPtr2, void *target2) {
+    if (linkPtr1) {
+      *linkPtr1 = (void*)((char*)target1 - base);
+      persist(linkPtr1, sizeof(void*));
+    }
+    if (linkPtr2) {
+      *linkPtr2 = (void*)((char*)target2 - base);
+      persist(linkPtr2, sizeof(void*));
+    }
+  }
+
+  IdEntry *findId(const char *id) {
+    for (auto &entry : pools[0]->header->ids) {
+      if (entry.state != Free && strcmp(entry.name, id) == 0) {
+        return &entry;
+      }
+    }
+    return nullptr;
+  }
+
+  void recoverBlocks(Pool &pool) {
+    auto header = pool.header;
+    for (auto &entry : header->ids) {
+      if (entry.state == Reserved) {
+        entry.state = Free;
+        persist(&entry.state, sizeof(entry.state));
+      }
+    }
+    for (auto offset = alignUp(sizeof(PoolHeader)); offset < header->top;) {
+      auto block = (BlockHeader*)(pool.start + offset);
+      if (block->state == Reserved) {
+        block->state = Free;
+        persist(&block->state, sizeof(block->state));
+      }
+      if (block->state == Free) {
+        pool.freeLists[block->size].push_back(offset);
+      }
+      offset += block->size;
+    }
+  }
+
+  char *base = nullptr;
+  uint64_t poolSize = 0;
+  std::vector<std::unique_ptr<Pool>> pools;
+};
+
+#ifdef AL_WITH_PMEMOBJ
+/**
+ * libpmemobj pool (build with -DAL_WITH_PMEMOBJ=ON).
+ * reserve/activate map to pmemobj_reserve/pmemobj_publish, links are published in
+ * the same action list. Named ids live in a table in the root object.
+ */
+class PmemobjBackend :public NvmBackend {
+  static const uint64_t MaxIds = 1024;
+  static const uint64_t IdLength = 48;
+  struct IdEntry {
+    char name[IdLength];
+    PMEMoid oid;
+  };
+  struct Root {
+    IdEntry ids[MaxIds];
+  };
+
+public:
+  const char *getName() const override { return "pmemobj"; }
+
+  void initialize(const char *path, bool recover) override {
+    mkdir(path, 0755);
+    auto file = string(path) + "/al.pmemobj";
+    pop = recover ? pmemobj_open(file.c_str(), "al") : nullptr;
+    if (pop == nullptr) {
+      unlink(file.c_str());
+      pop = pmemobj_create(file.c_str(), "al", poolSizeFromEnv(), 0644);
+    }
+    if (pop == nullptr) {
+      cerr << "cannot open nvm pool '" << file << "': " << pmemobj_errormsg() << endl;
+      abort();
+    }
+    root = (Root*)pmemobj_direct(pmemobj_root(pop, sizeof(Root)));
+  }
+
+  void *reserve(uint64_t nBytes) override {
+    pobj_action action;
+    auto oid = pmemobj_reserve(pop, &action, nBytes, 0);
+    if (OID_IS_NULL(oid)) {
+      cerr << "nvm pool exhausted, set AL_NVM_POOL_SIZE_MB" << endl;
+      abort();
+    }
+    auto p = pmemobj_direct(oid);
+    std::lock_guard<std::mutex> lock(mutex);
+    reserved[p] = action;
+    return p;
+  }
+
+  void *reserveId(const char *id, uint64_t nBytes) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &entry : root->ids) {
+      if (OID_IS_NULL(entry.oid)) {
+        if (pmemobj_zalloc(pop, &entry.oid, nBytes, 0) != 0) {
+          cerr << "nvm pool exhausted, set AL_NVM_POOL_SIZE_MB" << endl;
+          abort();
+        }
+        strncpy(entry.name, id, IdLength - 1);
+        pmemobj_persist(pop, entry.name, IdLength);
+        return pmemobj_direct(entry.oid);
+      }
+    }
+    cerr << "too many nvm ids" << endl;
+    abort();
+  }
+
+  void activate(void *ptr, void **linkPtr1, void *target1, void **linkPtr2, void *target2) override {
+    std::vector<pobj_action> actions;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = reserved.find(ptr);
+      if (it == reserved.end()) {
+        cerr << "activating memory that is not reserved" << endl;
+        abort();
+      }
+      actions.push_back(it->second);
+      reserved.erase(it);
+    }
+    appendLinks(actions, linkPtr1, target1, linkPtr2, target2);
+    pmemobj_publish(pop, actions.data(), actions.size());
+  }
+
+  // ids are allocated atomically into the root table already
+  void activateId(const char *id) override {}
+
+  void *getId(const char *id) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &entry : root->ids) {
+      if (!OID_IS_NULL(entry.oid) && strcmp(entry.name, id) == 0) {
+        return pmemobj_direct(entry.oid);
+      }
+    }
+    return nullptr;
+  }
+
+  void free(void *ptr, void **linkPtr1, void *target1, void **linkPtr2, void *target2) override {
+    std::vector<pobj_action> actions(1);
+    pmemobj_defer_free(pop, pmemobj_oid(ptr), &actions[0]);
+    appendLinks(actions, linkPtr1, target1, linkPtr2, target2);
+    pmemobj_publish(pop, actions.data(), actions.size());
+  }
+
+  void persist(const void *ptr, uint64_t nBytes) override {
+    pmemobj_persist(pop, ptr, nBytes);
+  }
+
+  void *abs(void *relPtr) override {
+    return (char*)pop + (uintptr_t)relPtr;
+  }
+
+  bool forEachAllocation(AllocationVisitor visit, void *ctx) override {
+    for (auto oid = pmemobj_first(pop); !OID_IS_NULL(oid); oid = pmemobj_next(oid)) {
+      visit(pmemobj_direct(oid), pmemobj_alloc_usable_size(oid), ctx);
+    }
+    return true;
+  }
+
+private:
+  void appendLinks(std::vector<pobj_action> &actions, void **linkPtr1, void *target1, void **linkPtr2, void *target2) {
+    for (auto link : {std::make_pair(linkPtr1, target1), std::make_pair(linkPtr2, target2)}) {
+      if (link.first) {
+        actions.emplace_back();
+        pmemobj_set_value(pop, &actions.back(), (uint64_t*)link.first, (char*)link.second - (char*)pop);
+      }
+    }
+  }
+
+  PMEMobjpool *pop = nullptr;
+  Root *root = nullptr;
+  std::mutex mutex;
+  std::map<void*, pobj_action> reserved;
+};
+#endif
+
+std::unique_ptr<NvmBackend> backend;
+std::once_flag backendOnce;
+
+std::unique_ptr<NvmBackend> createBackend(const string &name) {
+  if (name.empty() || name == "nvm_malloc") {
+    return std::unique_ptr<NvmBackend>(new NvmMallocBackend);
+  }
+  if (name == "mmap") {
+    return std::unique_ptr<NvmBackend>(new MmapBackend);
+  }
+#ifdef AL_WITH_PMEMOBJ
+  if (name == "pmemobj") {
+    return std::unique_ptr<NvmBackend>(new PmemobjBackend);
+  }
+#endif
+  cerr << "unknown AL_NVM_BACKEND '" << name << "'" << endl;
+  abort();
+}
+
+}
+
+NvmBackend &nvmInitialize(const char *path) {
+  std::call_once(backendOnce, [path]() {
+    auto name = getenv("AL_NVM_BACKEND");
+    backend = createBackend(name ? name : "");
+    auto start = std::chrono::steady_clock::now();
+    backend->initialize(path, true);
+    if (getenv("AL_NVM_REPORT_SETUP")) {
+      auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+      cerr << "nvm setup (" << backend->getName() << "): " << us << "us" << endl;
+    }
+  });
+  return *backend;
+}
+
+NvmBackend &nvmBackend() {
+  if (!backend) {
+    cerr << "nvm used before nvmSetup" << endl;
+    abort();
+  }
+  return *backend;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+
+/**
+ * Persistent memory allocator used by the runtime, selected once at start up
+ * with AL_NVM_BACKEND (nvm_malloc by default, mmap, pmemobj).
+ * Backends follow nvm_malloc's protocol: reserved memory is reclaimed after a crash
+ * unless it was activated, activate/free also write up to two links (pointers
+ * relative to the pool base) so an allocation can be published atomically.
+ */
+class NvmBackend {
+public:
+  virtual ~NvmBackend() = default;
+  virtual const char *getName() const = 0;
+  // path is a directory holding the pool
+  virtual void initialize(const char *path, bool recover) = 0;
+  virtual void *reserve(uint64_t nBytes) = 0;
+  virtual void *reserveId(const char *id, uint64_t nBytes) = 0;
+  virtual void activate(void *ptr, void **linkPtr1, void *target1, void **linkPtr2, void *target2) = 0;
+  virtual void activateId(const char *id) = 0;
+  virtual void *getId(const char *id) = 0;
+  virtual void free(void *ptr, void **linkPtr1, void *target1, void **linkPtr2, void *target2) = 0;
+  virtual void persist(const void *ptr, uint64_t nBytes) = 0;
+  // abs(nullptr) is the pool base
+  virtual void *abs(void *relPtr) = 0;
+  /**
+   * Calls visit with every allocation that is not free, its start as returned by
+   * reserve and its usable size. Returns false if the backend cannot enumerate its
+   * allocations (nvm_malloc). The caller keeps other threads from allocating meanwhile.
+   */
+  typedef void (*AllocationVisitor)(void *ptr, uint64_t nBytes, void *ctx);
+  virtual bool forEachAllocation(AllocationVisitor visit, void *ctx) { return false; }
+};
+
+// Initializes the backend on the first call, later calls only return it
+NvmBackend &nvmInitialize(const char *path);
+NvmBackend &nvmBackend();
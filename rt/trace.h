@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+
+/**
+ * Persist trace, written by the runtime when AL_NVM_TRACE names a file and read by altrace.
+ * Layout: AlTraceHeader, AlTraceRecord[], site table, AlTraceTrailer.
+ * Records are appended in per-thread chunks, ordered by timestamp only within a thread.
+ * The site table holds {int32 line, uint32 length, function name} per persist site
+ * followed by {uint32 length, source path}.
+ */
+enum AlTraceKind : uint8_t {
+  AlTraceStore = 0,
+  AlTraceFlush = 1,
+  AlTraceFence = 2
+};
+
+struct AlTraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+};
+
+struct AlTraceRecord {
+  uint64_t timestamp;
+  uint64_t addr;
+  uint32_t size;
+  // -1 for the runtime itself
+  int32_t site;
+  uint16_t thread;
+  uint8_t kind;
+  uint8_t reserved[5];
+};
+static_assert(sizeof(AlTraceRecord) == 32, "trace records are 32 bytes");
+
+struct AlTraceTrailer {
+  uint64_t siteTableOffset;
+  uint32_t nSites;
+  char magic[4];
+};
+
+static const char AlTraceMagic[8] = {'A', 'L', 'T', 'R', 'A', 'C', 'E', '\0'};
+static const char AlTraceTrailerMagic[4] = {'A', 'L', 'S', 'T'};
+static const uint32_t AlTraceVersion = 1;
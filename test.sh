@@ -2,6 +2,7 @@
 set -e
 ali=./build/ali
 for file in $(find ./test -type f | grep -E '.al$'); do
-  diff <($ali $file) $file.txt
+  flags=$(cat $file.flags 2>/dev/null || true)
+  diff <($ali $flags $file) $file.txt
   echo "OK '$file'"
 done
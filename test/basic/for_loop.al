@@ -1,7 +1,7 @@
 extern {
   fn putsInt(val: int32);
-  fn tic() *int32;
-  fn toc(ticVal: *int32) int32;
+  fn tic() int64;
+  fn toc(ticVal: int64) int32;
 }
 
 fn AL__main() {
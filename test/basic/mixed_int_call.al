@@ -0,0 +1,12 @@
+extern {
+  fn histRecord(id: int32, value: int64);
+  fn histDump(id: int32);
+}
+
+# mixed int32/int64 arguments: the int32 literal 9 is widened to int64, the ids stay int32
+fn AL__main() {
+  v: int64 = 7;
+  histRecord(0, v);
+  histRecord(0, 9);
+  histDump(0);
+}
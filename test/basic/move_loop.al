@@ -0,0 +1,15 @@
+extern {
+  fn putsInt(val: int32);
+}
+
+# y gets the same slot in every iteration, x must keep the value of the first one
+fn AL__main() {
+  x: int32 = 0;
+  for i: int32 = 0; i < 3; i = i + 1 {
+    y: int32 = i + 10;
+    if i == 0 {
+      x <- y;
+    };
+  };
+  putsInt(x);
+}
@@ -0,0 +1,35 @@
+struct Node {
+  next: *Node
+  data: int32
+}
+
+extern {
+  fn vAlloc(nBytes: int32) *Node;
+  fn putsInt(val: int32);
+}
+
+fn sumRegionList(n: int32) int32 {
+  sum: int32 = 0;
+  region {
+    head: *Node = vAlloc(sizeof(Node));
+    (*head).next = head;
+    (*head).data = 0;
+    for i: int32 = 1; i < n; i = i + 1 {
+      node: *Node = vAlloc(sizeof(Node));
+      (*node).data = i;
+      (*node).next = (*head).next;
+      (*head).next = node;
+    };
+
+    for cur: *Node = (*head).next; cur != head; cur = (*cur).next {
+      sum = sum + (*cur).data;
+    };
+  };
+  return (sum);
+}
+
+fn AL__main() {
+  for i: int32 = 4; i < 7; i = i + 1 {
+    putsInt(sumRegionList(1 << i));
+  };
+}
@@ -0,0 +1,18 @@
+extern {
+  fn putsInt(val: int32);
+}
+
+persistent {
+  total: int32
+}
+
+# @batch(var, 0) takes its batch size from --profile-use, every iteration without one
+fn AL__main() {
+  total = 0;
+  @batch(total, 0)
+  for i: int32 = 1; i < 1000; i = i + 1 {
+    total = total + i;
+  };
+
+  putsInt(total);
+}
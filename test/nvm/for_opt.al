@@ -1,7 +1,7 @@
 extern {
   fn putsInt(val: int32);
-  fn tic() *int32;
-  fn toc(x: *int32) int32;
+  fn tic() int64;
+  fn toc(x: int64) int32;
 }
 
 persistent {
@@ -9,7 +9,7 @@ persistent {
 }
 
 fn AL__main() {
-  a: *int32 = tic();
+  a: int64 = tic();
 
   @batch(sum, 100000)
   for i: int32 = 1; i < 100000; i = i + 1 {
@@ -0,0 +1,27 @@
+struct Node {
+  next: *persistent Node
+  data: int32
+}
+
+extern {
+  fn nvAllocObj(pp: ** persistent Node, typeId: int32);
+  fn putsInt(val: int32);
+}
+
+persistent {
+  head: *persistent Node
+}
+
+# the second argument is a gc root, its slot is linked after both argument slots
+fn addData(value: int32, node: *persistent Node) int32 {
+  return ((*node).data + value);
+}
+
+fn AL__main() {
+  node: *persistent Node = head;
+  nvAllocObj(&node, typeid(Node));
+  (*node).data = 40;
+  (*node).next = node;
+  head = node;
+  putsInt(addData(2, head));
+}
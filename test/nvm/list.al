@@ -7,8 +7,8 @@ struct Node {
 extern {
   fn nvAllocNBytes(pp: ** persistent Node, nBytes: int32);
   fn putsInt(val: int32);
-  fn tic() *int32;
-  fn toc(ticVal: *int32) int32;
+  fn tic() int64;
+  fn toc(ticVal: int64) int32;
 }
 
 persistent {
@@ -96,7 +96,7 @@ fn perfList(max: int32) {
   root.prev = &root;
   root.data = 0;
 
-  t: *int32 = tic();
+  t: int64 = tic();
   for i: int32 = 1; i < max; i = i + 1 {
     appendList(&root, i);
   };
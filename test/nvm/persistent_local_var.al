@@ -1,11 +1,11 @@
 extern {
   fn putsInt(val: int32);
-  fn tic() *int32;
-  fn toc(x: *int32) int32;
+  fn tic() int64;
+  fn toc(x: int64) int32;
 }
 
 fn AL__main() {
-  a: *int32 = tic();
+  a: int64 = tic();
   sum: persistent int32 = 0;
   tmp: persistent int32 = 0;
 
@@ -0,0 +1,30 @@
+struct Pair {
+  first: int32
+  second: int32
+}
+
+struct Node {
+  next: *persistent Node
+  data: int32
+}
+
+extern {
+  fn nvAllocObj(pp: ** persistent Node, typeId: int32);
+  fn putsInt(val: int32);
+}
+
+persistent {
+  head: *persistent Node
+}
+
+fn AL__main() {
+  putsInt(typeid(Pair));
+  putsInt(typeid(Node));
+
+  node: *persistent Node = head;
+  nvAllocObj(&node, typeid(Node));
+  (*node).data = 42;
+  (*node).next = node;
+  head = node;
+  putsInt((*head).data);
+}
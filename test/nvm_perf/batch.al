@@ -1,11 +1,11 @@
 extern {
   fn putsInt(val: int32);
-  fn tic() *int32;
-  fn toc(ticVal: *int32) int32;
+  fn tic() int64;
+  fn toc(ticVal: int64) int32;
 }
 
 fn sum_no_opt(max: int32) {
-  t1: *int32 = tic();
+  t1: int64 = tic();
 
   sum: int32 = 0;
 
@@ -16,7 +16,7 @@ fn sum_no_opt(max: int32) {
   putsInt(toc(t1));
 }
 fn sum_batch_opt(max: int32) {
-  t1: *int32 = tic();
+  t1: int64 = tic();
 
   sum: int32 = 0;
 
@@ -0,0 +1,66 @@
+struct Node {
+  next: *persistent Node
+  data: int32
+}
+
+extern {
+  fn nvAllocObj(pp: ** persistent Node, typeId: int32);
+  fn nvCompact(root: ** persistent Node, order: int32);
+  fn putsInt(val: int32);
+  fn tic() int64;
+  fn toc(ticVal: int64) int32;
+}
+
+persistent {
+  listA: *persistent Node
+  listB: *persistent Node
+}
+
+fn sumList(n: int32) {
+  t: int64 = tic();
+  sum: int32 = 0;
+  node: *persistent Node = listA;
+  for i: int32 = 0; i < n; i = i + 1 {
+    sum = sum + (*node).data;
+    node = (*node).next;
+  };
+  putsInt(toc(t));
+}
+
+fn perfCompact(max: int32) {
+  # interleave two lists, so the nodes of each one are scattered
+  a: *persistent Node = listA;
+  b: *persistent Node = listB;
+  for i: int32 = 0; i < max; i = i + 1 {
+    nvAllocObj(&a, typeid(Node));
+    (*a).data = i;
+    (*a).next = listA;
+    listA = a;
+    nvAllocObj(&b, typeid(Node));
+    (*b).data = i;
+    (*b).next = listB;
+    listB = b;
+  };
+
+  sumList(max);
+  # traversal order
+  nvCompact(&listA, 0);
+  sumList(max);
+}
+
+fn AL__main() {
+  # both lists end with a node pointing to itself
+  a: *persistent Node = listA;
+  nvAllocObj(&a, typeid(Node));
+  (*a).next = a;
+  listA = a;
+  b: *persistent Node = listB;
+  nvAllocObj(&b, typeid(Node));
+  (*b).next = b;
+  listB = b;
+
+  for i: int32 = 1; i < 15; i = i + 1 {
+    times: int32 = 1 << i;
+    perfCompact(times);
+  };
+}
@@ -0,0 +1,66 @@
+# 8 elements per chunk, fields can not be indexed
+struct Chunk {
+  next: *persistent Chunk
+  v0: int32
+  v1: int32
+  v2: int32
+  v3: int32
+  v4: int32
+  v5: int32
+  v6: int32
+  v7: int32
+}
+
+extern {
+  fn nvAllocNBytes(pp: **persistent Chunk, nBytes: int32);
+  fn putsInt64(val: int64);
+  fn tic() int64;
+  fn toc64(ticVal: int64) int64;
+}
+
+persistent {
+  first: *persistent Chunk
+}
+
+fn elementSlot(chunk: *persistent Chunk, i: int32) *persistent int32 {
+  slot: *persistent int32 = &(*chunk).v0;
+  if i == 1 { slot = &(*chunk).v1; };
+  if i == 2 { slot = &(*chunk).v2; };
+  if i == 3 { slot = &(*chunk).v3; };
+  if i == 4 { slot = &(*chunk).v4; };
+  if i == 5 { slot = &(*chunk).v5; };
+  if i == 6 { slot = &(*chunk).v6; };
+  if i == 7 { slot = &(*chunk).v7; };
+  return (slot);
+}
+
+# A persistent array of n int32 as a list of chunks: fill it element by element, then sum it
+fn AL__main() {
+  n: int32 = 100000;
+  chunk: *persistent Chunk = first;
+  nvAllocNBytes(&chunk, sizeof(Chunk));
+  first = chunk;
+
+  t: int64 = tic();
+  for i: int32 = 0; i < n; i = i + 1 {
+    if i % 8 == 0 {
+      if i != 0 {
+        next: *persistent Chunk = chunk;
+        nvAllocNBytes(&next, sizeof(Chunk));
+        (*chunk).next = next;
+        chunk = next;
+      };
+    };
+    *elementSlot(chunk, i % 8) = i;
+  };
+  putsInt64(toc64(t));
+
+  t = tic();
+  sum: int32 = 0;
+  cur: *persistent Chunk = first;
+  for i: int32 = 0; i < n; i = i + 8 {
+    sum = sum + (*cur).v0 + (*cur).v1 + (*cur).v2 + (*cur).v3 + (*cur).v4 + (*cur).v5 + (*cur).v6 + (*cur).v7;
+    cur = (*cur).next;
+  };
+  putsInt64(toc64(t));
+}
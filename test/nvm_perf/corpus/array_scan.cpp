@@ -0,0 +1,42 @@
+#include "baseline.h"
+
+struct Chunk {
+  Chunk *next;
+  int32_t v[8];
+};
+
+int main() {
+  baselineSetup();
+  auto first = baselineRoot<Chunk*>(0);
+  const int32_t n = 100000;
+  auto chunk = baselineAlloc<Chunk>();
+  *first = chunk;
+  nvPersist(first, sizeof(*first));
+
+  // each chunk is persisted once it is full
+  auto t = tic();
+  for (int32_t i = 0; i < n; ++i) {
+    if (i % 8 == 0 && i != 0) {
+      nvPersist(chunk, sizeof(Chunk));
+      auto next = baselineAlloc<Chunk>();
+      chunk->next = next;
+      nvPersist(&chunk->next, sizeof(Chunk*));
+      chunk = next;
+    }
+    chunk->v[i % 8] = i;
+  }
+  nvPersist(chunk, sizeof(Chunk));
+  putsInt64(toc64(t));
+
+  t = tic();
+  volatile int32_t sum = 0;
+  auto cur = *first;
+  for (int32_t i = 0; i < n; i += 8) {
+    for (auto v : cur->v) {
+      sum = sum + v;
+    }
+    cur = cur->next;
+  }
+  putsInt64(toc64(t));
+  AL__main_end();
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+
+/**
+ * Runtime functions used by the C++ baselines, they allocate, persist and time through
+ * the same runtime as the AL programs. A baseline persists what a careful C++
+ * programmer would: a new node once after filling it, then the link publishing it.
+ */
+extern "C" {
+void alLibInit();
+void threadLocalSetupMain();
+void nvmSetup();
+void AL__main_end();
+void *getNvmVar(int id, uint64_t size);
+void persistNvmVar(int id, uint64_t size);
+void nvAllocNBytes(int **p, uint32_t nBytes);
+void nvPersist(void *ptr, uint64_t nBytes);
+int64_t tic();
+int64_t toc64(int64_t ticVal);
+void putsInt64(int64_t i);
+}
+
+// Same start up as the main function the compiler generates
+inline void baselineSetup() {
+  alLibInit();
+  threadLocalSetupMain();
+  nvmSetup();
+}
+
+template<typename T>
+T *baselineAlloc() {
+  T *p;
+  nvAllocNBytes((int**)&p, sizeof(T));
+  return p;
+}
+
+// Persistent root var, made durable once
+template<typename T>
+T *baselineRoot(int id) {
+  auto p = (T*)getNvmVar(id, sizeof(T));
+  persistNvmVar(id, sizeof(T));
+  return p;
+}
@@ -0,0 +1,94 @@
+struct Node {
+  left: *persistent Node
+  right: *persistent Node
+  key: int32
+}
+
+extern {
+  fn nvAllocNBytes(pp: **persistent Node, nBytes: int32);
+  fn putsInt64(val: int64);
+  fn tic() int64;
+  fn toc64(ticVal: int64) int64;
+}
+
+persistent {
+  root: *persistent Node
+  nil: *persistent Node
+}
+
+fn insert(key: int32) {
+  newNode: *persistent Node = nil;
+  nvAllocNBytes(&newNode, sizeof(Node));
+  (*newNode).key = key;
+  (*newNode).left = nil;
+  (*newNode).right = nil;
+
+  cur: *persistent Node = root;
+  for done: int32 = 0; done == 0; done = done {
+    if key < (*cur).key {
+      if (*cur).left == nil {
+        (*cur).left = newNode;
+        done = 1;
+      } else {
+        cur = (*cur).left;
+      };
+    } else {
+      if (*cur).right == nil {
+        (*cur).right = newNode;
+        done = 1;
+      } else {
+        cur = (*cur).right;
+      };
+    };
+  };
+}
+
+fn lookup(key: int32) int32 {
+  found: int32 = 0;
+  cur: *persistent Node = root;
+  for a: int32 = 0; cur != nil; a = 0 {
+    if key == (*cur).key {
+      found = 1;
+      cur = nil;
+    } else {
+      if key < (*cur).key {
+        cur = (*cur).left;
+      } else {
+        cur = (*cur).right;
+      };
+    };
+  };
+  return (found);
+}
+
+# Unbalanced binary search tree: n inserts of pseudo random keys, then n lookups.
+# Keys come from x = 5x + 1 (mod 2^32), empty children point to the nil node.
+fn AL__main() {
+  n: int32 = 100000;
+  # out-parameters of the runtime must be volatile
+  node: *persistent Node = nil;
+  nvAllocNBytes(&node, sizeof(Node));
+  nil = node;
+  nvAllocNBytes(&node, sizeof(Node));
+  root = node;
+  x: int32 = 1;
+  (*root).key = x;
+  (*root).left = nil;
+  (*root).right = nil;
+
+  t: int64 = tic();
+  for i: int32 = 1; i < n; i = i + 1 {
+    x = (x << 2) + x + 1;
+    insert(x);
+  };
+  putsInt64(toc64(t));
+
+  t = tic();
+  found: int32 = 0;
+  x = 1;
+  for i: int32 = 0; i < n; i = i + 1 {
+    found = found + lookup(x);
+    x = (x << 2) + x + 1;
+  };
+  putsInt64(toc64(t));
+}
@@ -0,0 +1,70 @@
+#include "baseline.h"
+
+struct Node {
+  Node *left;
+  Node *right;
+  int32_t key;
+};
+
+Node **root;
+Node **nil;
+
+void insert(int32_t key) {
+  auto node = baselineAlloc<Node>();
+  node->key = key;
+  node->left = node->right = *nil;
+  nvPersist(node, sizeof(Node));
+
+  auto cur = *root;
+  while (true) {
+    auto &child = key < cur->key ? cur->left : cur->right;
+    if (child == *nil) {
+      child = node;
+      nvPersist(&child, sizeof(child));
+      return;
+    }
+    cur = child;
+  }
+}
+
+bool lookup(int32_t key) {
+  for (auto cur = *root; cur != *nil; cur = key < cur->key ? cur->left : cur->right) {
+    if (cur->key == key) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int main() {
+  baselineSetup();
+  root = baselineRoot<Node*>(0);
+  nil = baselineRoot<Node*>(1);
+  const int32_t n = 100000;
+  *nil = baselineAlloc<Node>();
+  nvPersist(nil, sizeof(*nil));
+  uint32_t x = 1;
+  auto node = baselineAlloc<Node>();
+  node->key = (int32_t)x;
+  node->left = node->right = *nil;
+  nvPersist(node, sizeof(Node));
+  *root = node;
+  nvPersist(root, sizeof(*root));
+
+  auto t = tic();
+  for (int32_t i = 1; i < n; ++i) {
+    x = 5 * x + 1;
+    insert((int32_t)x);
+  }
+  putsInt64(toc64(t));
+
+  t = tic();
+  volatile int32_t found = 0;
+  x = 1;
+  for (int32_t i = 0; i < n; ++i) {
+    found = found + lookup((int32_t)x);
+    x = 5 * x + 1;
+  }
+  putsInt64(toc64(t));
+  AL__main_end();
+}
@@ -0,0 +1,122 @@
+struct Entry {
+  next: *persistent Entry
+  key: int32
+  value: int32
+}
+
+struct Dir {
+  b0: *persistent Entry
+  b1: *persistent Entry
+  b2: *persistent Entry
+  b3: *persistent Entry
+  b4: *persistent Entry
+  b5: *persistent Entry
+  b6: *persistent Entry
+  b7: *persistent Entry
+}
+
+extern {
+  fn nvAllocNBytes(pp: **persistent Entry, nBytes: int32);
+  fn putsInt64(val: int64);
+  fn tic() int64;
+  fn toc64(ticVal: int64) int64;
+}
+
+# 64 buckets in 8 directories of 8, empty chains end in the nil entry
+persistent {
+  d0: Dir
+  d1: Dir
+  d2: Dir
+  d3: Dir
+  d4: Dir
+  d5: Dir
+  d6: Dir
+  d7: Dir
+  nil: *persistent Entry
+}
+
+# Fields can not be indexed, slots are picked by comparison
+fn bucketSlot(dir: *persistent Dir, i: int32) *persistent *persistent Entry {
+  slot: *persistent *persistent Entry = &(*dir).b0;
+  if i == 1 { slot = &(*dir).b1; };
+  if i == 2 { slot = &(*dir).b2; };
+  if i == 3 { slot = &(*dir).b3; };
+  if i == 4 { slot = &(*dir).b4; };
+  if i == 5 { slot = &(*dir).b5; };
+  if i == 6 { slot = &(*dir).b6; };
+  if i == 7 { slot = &(*dir).b7; };
+  return (slot);
+}
+
+fn dirSlot(i: int32) *persistent Dir {
+  dir: *persistent Dir = &d0;
+  if i == 1 { dir = &d1; };
+  if i == 2 { dir = &d2; };
+  if i == 3 { dir = &d3; };
+  if i == 4 { dir = &d4; };
+  if i == 5 { dir = &d5; };
+  if i == 6 { dir = &d6; };
+  if i == 7 { dir = &d7; };
+  return (dir);
+}
+
+fn positive(x: int32) int32 {
+  if x < 0 {
+    x = 0 - x;
+  };
+  return (x);
+}
+
+fn bucket(key: int32) *persistent *persistent Entry {
+  return (bucketSlot(dirSlot(positive(key % 8)), positive(key % 61) % 8));
+}
+
+fn put(key: int32, value: int32) {
+  slot: *persistent *persistent Entry = bucket(key);
+  entry: *persistent Entry = nil;
+  nvAllocNBytes(&entry, sizeof(Entry));
+  (*entry).key = key;
+  (*entry).value = value;
+  (*entry).next = *slot;
+  *slot = entry;
+}
+
+fn get(key: int32) int32 {
+  value: int32 = 0;
+  for cur: *persistent Entry = *bucket(key); cur != nil; cur = (*cur).next {
+    if (*cur).key == key {
+      value = (*cur).value;
+    };
+  };
+  return (value);
+}
+
+# Chained hash map: n inserts of pseudo random keys (x = 5x + 1 mod 2^32), then n lookups
+fn AL__main() {
+  n: int32 = 20000;
+  entry: *persistent Entry = nil;
+  nvAllocNBytes(&entry, sizeof(Entry));
+  nil = entry;
+  for i: int32 = 0; i < 8; i = i + 1 {
+    for j: int32 = 0; j < 8; j = j + 1 {
+      *bucketSlot(dirSlot(i), j) = nil;
+    };
+  };
+
+  t: int64 = tic();
+  x: int32 = 1;
+  for i: int32 = 0; i < n; i = i + 1 {
+    put(x, i);
+    x = (x << 2) + x + 1;
+  };
+  putsInt64(toc64(t));
+
+  t = tic();
+  sum: int32 = 0;
+  x = 1;
+  for i: int32 = 0; i < n; i = i + 1 {
+    sum = sum + get(x);
+    x = (x << 2) + x + 1;
+  };
+  putsInt64(toc64(t));
+}
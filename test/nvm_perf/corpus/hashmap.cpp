@@ -0,0 +1,76 @@
+#include <cstdlib>
+#include "baseline.h"
+
+struct Entry {
+  Entry *next;
+  int32_t key;
+  int32_t value;
+};
+
+// 64 buckets in 8 directories of 8 like hashmap.al
+struct Dir {
+  Entry *b[8];
+};
+
+Dir *dirs[8];
+Entry **nil;
+
+Entry *&bucket(int32_t key) {
+  return dirs[abs(key % 8)]->b[abs(key % 61) % 8];
+}
+
+void put(int32_t key, int32_t value) {
+  auto &slot = bucket(key);
+  auto entry = baselineAlloc<Entry>();
+  entry->key = key;
+  entry->value = value;
+  entry->next = slot;
+  nvPersist(entry, sizeof(Entry));
+  slot = entry;
+  nvPersist(&slot, sizeof(slot));
+}
+
+int32_t get(int32_t key) {
+  int32_t value = 0;
+  for (auto cur = bucket(key); cur != *nil; cur = cur->next) {
+    if (cur->key == key) {
+      value = cur->value;
+    }
+  }
+  return value;
+}
+
+int main() {
+  baselineSetup();
+  for (int i = 0; i < 8; ++i) {
+    dirs[i] = baselineRoot<Dir>(i);
+  }
+  nil = baselineRoot<Entry*>(8);
+  const int32_t n = 20000;
+  *nil = baselineAlloc<Entry>();
+  nvPersist(nil, sizeof(*nil));
+  for (auto dir : dirs) {
+    for (auto &b : dir->b) {
+      b = *nil;
+    }
+    nvPersist(dir, sizeof(Dir));
+  }
+
+  auto t = tic();
+  uint32_t x = 1;
+  for (int32_t i = 0; i < n; ++i) {
+    put((int32_t)x, i);
+    x = 5 * x + 1;
+  }
+  putsInt64(toc64(t));
+
+  t = tic();
+  volatile int32_t sum = 0;
+  x = 1;
+  for (int32_t i = 0; i < n; ++i) {
+    sum = sum + get((int32_t)x);
+    x = 5 * x + 1;
+  }
+  putsInt64(toc64(t));
+  AL__main_end();
+}
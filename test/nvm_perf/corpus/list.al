@@ -0,0 +1,38 @@
+struct Node {
+  next: *persistent Node
+  key: int32
+}
+
+extern {
+  fn nvAllocNBytes(pp: **persistent Node, nBytes: int32);
+  fn putsInt64(val: int64);
+  fn tic() int64;
+  fn toc64(ticVal: int64) int64;
+}
+
+persistent {
+  head: *persistent Node
+}
+
+# Pushes n nodes to the front of a persistent list, then walks it
+fn AL__main() {
+  n: int32 = 100000;
+  t: int64 = tic();
+  for i: int32 = 0; i < n; i = i + 1 {
+    node: *persistent Node = head;
+    nvAllocNBytes(&node, sizeof(Node));
+    (*node).key = i;
+    (*node).next = head;
+    head = node;
+  };
+  putsInt64(toc64(t));
+
+  t = tic();
+  sum: int32 = 0;
+  cur: *persistent Node = head;
+  for i: int32 = 0; i < n; i = i + 1 {
+    sum = sum + (*cur).key;
+    cur = (*cur).next;
+  };
+  putsInt64(toc64(t));
+}
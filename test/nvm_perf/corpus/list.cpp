@@ -0,0 +1,33 @@
+#include "baseline.h"
+
+struct Node {
+  Node *next;
+  int32_t key;
+};
+
+int main() {
+  baselineSetup();
+  auto head = baselineRoot<Node*>(0);
+  const int32_t n = 100000;
+
+  auto t = tic();
+  for (int32_t i = 0; i < n; ++i) {
+    auto node = baselineAlloc<Node>();
+    node->key = i;
+    node->next = *head;
+    nvPersist(node, sizeof(Node));
+    *head = node;
+    nvPersist(head, sizeof(*head));
+  }
+  putsInt64(toc64(t));
+
+  t = tic();
+  volatile int32_t sum = 0;
+  auto cur = *head;
+  for (int32_t i = 0; i < n; ++i) {
+    sum = sum + cur->key;
+    cur = cur->next;
+  }
+  putsInt64(toc64(t));
+  AL__main_end();
+}
@@ -0,0 +1,43 @@
+struct Node {
+  next: *persistent Node
+  key: int32
+}
+
+extern {
+  fn nvAllocNBytes(pp: **persistent Node, nBytes: int32);
+  fn putsInt64(val: int64);
+  fn tic() int64;
+  fn toc64(ticVal: int64) int64;
+}
+
+persistent {
+  head: *persistent Node
+  tail: *persistent Node
+}
+
+# FIFO queue with a sentinel head: n enqueues at the tail, then n dequeues
+fn AL__main() {
+  n: int32 = 100000;
+  sentinel: *persistent Node = head;
+  nvAllocNBytes(&sentinel, sizeof(Node));
+  head = sentinel;
+  tail = sentinel;
+
+  t: int64 = tic();
+  for i: int32 = 0; i < n; i = i + 1 {
+    node: *persistent Node = tail;
+    nvAllocNBytes(&node, sizeof(Node));
+    (*node).key = i;
+    (*tail).next = node;
+    tail = node;
+  };
+  putsInt64(toc64(t));
+
+  t = tic();
+  sum: int32 = 0;
+  for i: int32 = 0; i < n; i = i + 1 {
+    head = (*head).next;
+    sum = sum + (*head).key;
+  };
+  putsInt64(toc64(t));
+}
@@ -0,0 +1,38 @@
+#include "baseline.h"
+
+struct Node {
+  Node *next;
+  int32_t key;
+};
+
+int main() {
+  baselineSetup();
+  auto head = baselineRoot<Node*>(0);
+  auto tail = baselineRoot<Node*>(1);
+  const int32_t n = 100000;
+  *head = *tail = baselineAlloc<Node>();
+  nvPersist(head, sizeof(*head));
+  nvPersist(tail, sizeof(*tail));
+
+  auto t = tic();
+  for (int32_t i = 0; i < n; ++i) {
+    auto node = baselineAlloc<Node>();
+    node->key = i;
+    nvPersist(node, sizeof(Node));
+    (*tail)->next = node;
+    nvPersist(&(*tail)->next, sizeof(Node*));
+    *tail = node;
+    nvPersist(tail, sizeof(*tail));
+  }
+  putsInt64(toc64(t));
+
+  t = tic();
+  volatile int32_t sum = 0;
+  for (int32_t i = 0; i < n; ++i) {
+    *head = (*head)->next;
+    nvPersist(head, sizeof(*head));
+    sum = sum + (*head)->key;
+  }
+  putsInt64(toc64(t));
+  AL__main_end();
+}
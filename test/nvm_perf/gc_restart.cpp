@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Restart time of the collector (AL_GC_ON_START=1) against heap size and gc threads.
+ * Every run builds a fresh pool in one process, a binary tree of live objects with as
+ * many garbage objects allocated in between, then restarts on it in another process
+ * and reports the pool setup and the collection separately.
+ * Usage: gc_restart [max threads], all cores by default.
+ */
+extern "C" {
+struct AlTypeDescriptor {
+  uint64_t size;
+  const uint64_t *pointerBitmap;
+  const uint64_t *rcBitmap;
+};
+void alLibInit();
+void threadLocalSetupMain();
+void nvmSetup();
+void alRegisterTypeDescriptors(const AlTypeDescriptor *descs, uint32_t n);
+void alGcSetup(int32_t shadowStack, int32_t writeBarrier);
+void *getNvmVar(int id, uint64_t size);
+void persistNvmVar(int id, uint64_t size);
+void nvAllocObj(int **p, uint32_t typeId);
+void nvPersist(void *ptr, uint64_t nBytes);
+}
+
+struct Node {
+  Node *left;
+  Node *right;
+  int64_t value;
+};
+const uint64_t NodePointers[] = {0x3};
+const uint64_t NodeRcPointers[] = {0};
+const AlTypeDescriptor Descriptors[] = {{sizeof(Node), NodePointers, NodeRcPointers}};
+
+void setup() {
+  alLibInit();
+  threadLocalSetupMain();
+  nvmSetup();
+  alRegisterTypeDescriptors(Descriptors, 1);
+}
+
+Node *alloc() {
+  Node *p;
+  nvAllocObj((int**)&p, 0);
+  return p;
+}
+
+void buildHeap(uint64_t nLive) {
+  setup();
+  std::vector<Node*> nodes;
+  for (uint64_t i = 0; i < nLive; ++i) {
+    nodes.push_back(alloc());
+    auto garbage = alloc();
+    garbage->left = garbage->right = nullptr;
+    nvPersist(garbage, sizeof(Node));
+  }
+  for (uint64_t i = 0; i < nLive; ++i) {
+    nodes[i]->left = 2 * i + 1 < nLive ? nodes[2 * i + 1] : nullptr;
+    nodes[i]->right = 2 * i + 2 < nLive ? nodes[2 * i + 2] : nullptr;
+    nodes[i]->value = (int64_t)i;
+    nvPersist(nodes[i], sizeof(Node));
+  }
+  auto root = (Node**)getNvmVar(0, sizeof(Node*));
+  *root = nodes[0];
+  persistNvmVar(0, sizeof(Node*));
+}
+
+uint64_t countTree(Node *node) {
+  return node == nullptr ? 0 : 1 + countTree(node->left) + countTree(node->right);
+}
+
+double msSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+}
+
+void restart(uint64_t nLive, unsigned threads) {
+  setenv("AL_GC_ON_START", "1", 1);
+  setenv("AL_GC_THREADS", std::to_string(threads).c_str(), 1);
+  auto start = std::chrono::steady_clock::now();
+  setup();
+  auto setupMs = msSince(start);
+  start = std::chrono::steady_clock::now();
+  alGcSetup(0, 0);
+  auto gcMs = msSince(start);
+
+  auto live = countTree(*(Node**)getNvmVar(0, sizeof(Node*)));
+  if (live != nLive) {
+    fprintf(stderr, "gc_restart: %lu live objects, expected %lu\n", (unsigned long)live, (unsigned long)nLive);
+    exit(1);
+  }
+  printf("%lu, %u, %.1f, %.1f\n", (unsigned long)(2 * nLive), threads, setupMs, gcMs);
+}
+
+// The runtime is set up once per process, so every step runs in a child
+void runChild(void (*fn)(uint64_t, unsigned), uint64_t nLive, unsigned threads) {
+  fflush(stdout);
+  auto pid = fork();
+  if (pid == 0) {
+    fn(nLive, threads);
+    fflush(stdout);
+    _exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "gc_restart: child failed\n");
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned maxThreads = argc > 1 ? (unsigned)atoi(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+  // the collector enumerates allocations, which nvm_malloc cannot
+  setenv("AL_NVM_BACKEND", "mmap", 0);
+
+  printf("objects, threads, pool setup ms, gc ms\n");
+  for (uint64_t nLive = 1 << 15; nLive <= 1 << 19; nLive <<= 2) {
+    for (unsigned threads = 1;; threads = std::min(2 * threads, maxThreads)) {
+      char dir[] = "/tmp/gc_restart.XXXXXX";
+      if (mkdtemp(dir) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+      }
+      setenv("AL_NVM_PATH", dir, 1);
+      setenv("AL_NVM_POOL_SIZE_MB", std::to_string(2 * nLive * 128 / (1024 * 1024) + 16).c_str(), 1);
+      runChild([](uint64_t nLive, unsigned) { buildHeap(nLive); }, nLive, threads);
+      runChild(restart, nLive, threads);
+      system(("rm -rf " + std::string(dir)).c_str());
+      if (threads == maxThreads) {
+        break;
+      }
+    }
+  }
+}
@@ -0,0 +1,40 @@
+struct Node {
+  next: *persistent Node
+  data: int32
+}
+
+extern {
+  fn nvAllocObj(pp: ** persistent Node, typeId: int32);
+  fn putsInt(val: int32);
+  fn tic() int64;
+  fn toc(ticVal: int64) int32;
+}
+
+persistent {
+  head: *persistent Node
+  count: int32
+}
+
+# The first run builds the list, later runs measure the first pass over it
+# right after the pool was mapped
+fn AL__main() {
+  if count == 0 {
+    node: *persistent Node = head;
+    for i: int32 = 0; i < 1048576; i = i + 1 {
+      nvAllocObj(&node, typeid(Node));
+      (*node).data = i;
+      (*node).next = head;
+      head = node;
+    };
+    count = 1048576;
+  };
+
+  t: int64 = tic();
+  sum: int32 = 0;
+  cur: *persistent Node = head;
+  for i: int32 = 0; i < count; i = i + 1 {
+    sum = sum + (*cur).data;
+    cur = (*cur).next;
+  };
+  putsInt(toc(t));
+}
@@ -0,0 +1,45 @@
+struct Node {
+  next: rc<persistent Node>
+  data: int32
+}
+
+extern {
+  fn rcAlloc(pp: *rc<persistent Node>, typeId: int32);
+  fn rcNull() rc<persistent Node>;
+  fn rcEpoch();
+  fn putsInt(val: int32);
+  fn tic() int64;
+  fn toc(ticVal: int64) int32;
+}
+
+fn perfRcList(max: int32) {
+  head: rc<persistent Node> = rcNull();
+
+  t: int64 = tic();
+  for i: int32 = 0; i < max; i = i + 1 {
+    node: rc<persistent Node> = rcNull();
+    rcAlloc(&node, typeid(Node));
+    (*node).data = i;
+    (*node).next = head;
+    head = node;
+  };
+  # pop all but the first node
+  for i: int32 = 1; i < max; i = i + 1 {
+    head = (*head).next;
+  };
+  putsInt(toc(t));
+
+  # dropping the head releases the whole list
+  t2: int64 = tic();
+  head = rcNull();
+  rcEpoch();
+  rcEpoch();
+  putsInt(toc(t2));
+}
+
+fn AL__main() {
+  for i: int32 = 1; i < 15; i = i + 1 {
+    times: int32 = 1 << i;
+    perfRcList(times);
+  };
+}
@@ -0,0 +1,26 @@
+extern {
+  fn putsInt64(val: int64);
+  fn tic() int64;
+  fn toc64(ticVal: int64) int64;
+  fn timerStart(id: int32);
+  fn timerStop(id: int32) int64;
+  fn histDump(id: int32);
+}
+
+persistent {
+  sum: int32
+}
+
+# Latency of single persisted increments in histogram 0 and the whole loop with toc64
+fn AL__main() {
+  t: int64 = tic();
+  total: int64 = 0;
+  for i: int32 = 0; i < 100000; i = i + 1 {
+    timerStart(0);
+    sum = sum + 1;
+    total = total + timerStop(0);
+  };
+  putsInt64(toc64(t));
+  putsInt64(total);
+  histDump(0);
+}
@@ -1,7 +1,7 @@
 extern {
   fn putsInt(val: int32);
-  fn tic() *int32;
-  fn toc(ticVal: *int32) int32;
+  fn tic() int64;
+  fn toc(ticVal: int64) int32;
 }
 persistent {
   tmp: int32
@@ -9,7 +9,7 @@ persistent {
 }
 
 fn sum_opt(max: int32) {
-  t1: *int32 = tic();
+  t1: int64 = tic();
 
 
   for k: int32 = 0; k < max; k = k + 1 {